@@ -12,11 +12,13 @@
 #include "../include/optiheap_allocator.h"
 #define MALLOC(size) optiheap_allocate(size)
 #define FREE(ptr) optiheap_free(ptr)
+#define REALLOC(ptr, size) optiheap_reallocate(ptr, size)
 #define ALLOCATOR_NAME "OptiHeap"
 #define INITIALIZE_ALLOCATOR() optiheap_allocator_init()
 #else
 #define MALLOC(size) malloc(size)
 #define FREE(ptr) free(ptr)
+#define REALLOC(ptr, size) realloc(ptr, size)
 #define ALLOCATOR_NAME "glibc"
 #define INITIALIZE_ALLOCATOR()
 #endif
@@ -361,6 +363,74 @@ static benchmark_result_t test_fragmentation(const benchmark_config_t* config) {
     return result;
 }
 
+// Marker written to the last byte of a grown buffer, checked after the next reallocation
+static uint8_t buffer_tail_pattern(size_t size) {
+    return (uint8_t)(size >> 6);
+}
+
+// Test 4: Growing buffers by repeated doubling (vector push_back pattern)
+static benchmark_result_t test_realloc_doubling(const benchmark_config_t* config) {
+    printf("Running %s test with %s allocator...\n", config->name, ALLOCATOR_NAME);
+    
+    // Reset memory tracking
+    current_memory_usage = 0;
+    peak_memory_usage = 0;
+    total_allocated = 0;
+    total_freed = 0;
+    
+    double start_time = get_time_ms();
+    size_t successful_ops = 0;
+    
+    for (size_t i = 0; i < config->num_allocations; i++) {
+        size_t size = config->min_size;
+        uint8_t* buffer = tracked_malloc(size);
+        if (!buffer) {
+            continue;
+        }
+        buffer[size - 1] = buffer_tail_pattern(size);
+        successful_ops++;
+        
+        while (size * 2 <= config->max_size) {
+            size_t new_size = size * 2;
+            if (current_memory_usage + new_size - size > MAX_MEMORY_USAGE) {
+                break;
+            }
+            uint8_t* grown = REALLOC(buffer, new_size);
+            if (!grown || grown == (void*)-1) {
+                break; // Failed reallocations leave the old buffer intact
+            }
+            
+            // The preserved prefix must survive the move, only the new half is touched
+            assert(grown[size - 1] == buffer_tail_pattern(size));
+            update_memory_stats(new_size - size, 1);
+            populate_memory(grown + size, new_size - size);
+            grown[new_size - 1] = buffer_tail_pattern(new_size);
+            buffer = grown;
+            size = new_size;
+            successful_ops++;
+        }
+        
+        tracked_free(buffer, size);
+        successful_ops++;
+    }
+    
+    double end_time = get_time_ms();
+    double total_time = end_time - start_time;
+    
+    benchmark_result_t result = {
+        .test_name = config->name,
+        .allocator_name = ALLOCATOR_NAME,
+        .total_time_ms = total_time,
+        .total_operations = successful_ops,
+        .kops_per_sec = (successful_ops / (total_time / 1000.0)) / 1000.0,
+        .peak_memory_usage = peak_memory_usage,
+        .total_allocated = total_allocated,
+        .total_freed = total_freed
+    };
+    
+    return result;
+}
+
 static void write_csv_header(FILE* fp) {
     fprintf(fp, "Test,Allocator,Time_ms,Total_Operations,KOps_per_sec,Peak_Memory_MB,Total_Allocated_MB,Total_Freed_MB\n");
 }
@@ -395,7 +465,8 @@ int main(int argc, char* argv[]) {
         {"Mixed_Random", 16, 1024*1024, 25000, 0.3},
         {"Small_Fragmentation", 16, 1024, 200000, 0.8},
         {"Medium_Fragmentation", 1024, 64*1024, 20000, 0.8},
-        {"Large_Fragmentation", 64*1024, 512*1024, 2000, 0.8}
+        {"Large_Fragmentation", 64*1024, 512*1024, 2000, 0.8},
+        {"Realloc_Doubling", 64, 64*1024*1024, 200, 0.0}
     };
     
     size_t num_configs = sizeof(configs) / sizeof(configs[0]);
@@ -430,6 +501,8 @@ int main(int argc, char* argv[]) {
             result = test_random_pattern(&configs[i]);
         } else if (strstr(configs[i].name, "Fragmentation")) {
             result = test_fragmentation(&configs[i]);
+        } else if (strstr(configs[i].name, "Realloc")) {
+            result = test_realloc_doubling(&configs[i]);
         } else {
             result = test_sequential(&configs[i]); // Default
         }
@@ -73,7 +73,7 @@ echo
 
 # Compile OptiHeap version
 echo -e "${YELLOW}Compiling OptiHeap benchmark...${NC}"
-gcc "$BENCHMARK_SOURCE" ../src/optiheap_allocator.c ../src/heap_allocator.c ../src/mmap_allocator.c \
+gcc "$BENCHMARK_SOURCE" ../src/*.c \
     -o "$OPTIHEAP_EXECUTABLE" -O2 -std=c99 -Wall -Wextra -DUSE_OPTIHEAP
 if [ $? -eq 0 ]; then
     echo -e "${GREEN}OptiHeap benchmark compiled successfully.${NC}"
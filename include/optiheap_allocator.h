@@ -3,15 +3,106 @@
 
 #include <stddef.h>
 
+// Runtime tunables accepted by optiheap_set_option / optiheap_get_option
+enum optiheap_option {
+    OPTIHEAP_OPTION_THREAD_CACHE_DEPTH, // Max blocks cached per size class per thread (0 disables the cache)
+    OPTIHEAP_OPTION_MMAP_THRESHOLD, // Requests above this many bytes use mmap, setting it pins it
+    OPTIHEAP_OPTION_MMAP_THRESHOLD_MAX, // Ceiling of the adaptive threshold, setting it resumes adaptation
+    OPTIHEAP_OPTION_HEAP_TRIM_THRESHOLD, // Dirty bytes in the free tail of a heap segment that trigger its decommit
+    OPTIHEAP_OPTION_HEAP_RELEASE_THRESHOLD, // Free blocks this large get their pages released with madvise (SIZE_MAX disables)
+    OPTIHEAP_OPTION_MMAP_CACHE_LIMIT, // Max bytes of freed mmap regions kept for reuse (0 disables the cache)
+    OPTIHEAP_OPTION_MMAP_CACHE_DECAY_MS, // Milliseconds a freed mmap region is kept before it is returned to the OS
+    OPTIHEAP_OPTION_ARENA_COUNT, // Heap arenas new threads are spread over (thread-safe builds only)
+    OPTIHEAP_OPTION_HUGE_PAGES, // One of enum optiheap_huge_pages, applies to segments and mappings made afterwards
+};
+
+// Values of OPTIHEAP_OPTION_HUGE_PAGES
+enum optiheap_huge_pages {
+    OPTIHEAP_HUGE_PAGES_OFF, // Base pages only
+    OPTIHEAP_HUGE_PAGES_TRANSPARENT, // Heap segments and large mappings are 2 MiB aligned and advised with MADV_HUGEPAGE
+    OPTIHEAP_HUGE_PAGES_EXPLICIT, // Large mappings use hugetlbfs pages (MAP_HUGETLB), transparent ones when none are left
+};
+
+// Flags of optiheap_allocate_flags, combined with |
+enum optiheap_allocate_flag {
+    OPTIHEAP_ALLOCATE_ZERO = 1, // The block is zero-initialised, as with optiheap_calloc
+    OPTIHEAP_ALLOCATE_POPULATE = 2, // The block's pages are faulted in before it is returned
+};
+
+// Expected demand for one object size, see optiheap_warmup
+struct optiheap_warmup_class {
+    size_t size; // Requested object size in bytes
+    size_t count; // Objects of that size expected to be live at the same time
+};
+
+// Snapshot of one heap arena, filled by optiheap_get_arena_stats
+struct optiheap_arena_stats {
+    size_t segments; // Reserved heap segments
+    size_t committed_bytes; // Bytes committed in those segments
+    size_t used_bytes; // Bytes carved into blocks that are not free, headers and thread caches included
+    size_t free_bytes; // Bytes of payload in the arena's free lists
+    size_t threads; // Live threads assigned to the arena
+    size_t contended_locks; // Lock acquisitions that had to wait for another thread
+    size_t remote_frees; // Blocks freed by threads of other arenas, queued or freed directly
+};
+
+// Memory on huge pages per tier, filled by optiheap_get_huge_page_stats
+struct optiheap_huge_page_stats {
+    size_t heap_advised_bytes; // Committed bytes of heap segments advised to use transparent huge pages
+    size_t heap_huge_bytes; // Heap bytes the kernel actually backs with transparent huge pages
+    size_t mmap_advised_bytes; // Bytes of live mmap blocks advised to use transparent huge pages
+    size_t mmap_hugetlb_bytes; // Bytes of live mmap blocks mapped from hugetlbfs
+    size_t mmap_huge_bytes; // Bytes of live mmap blocks actually on huge pages, hugetlbfs and transparent ones
+};
+
+// Contention on the allocator's locks, filled by optiheap_get_lock_stats in builds with OPTIHEAP_LOCK_STATS
+struct optiheap_lock_stats {
+    size_t contended_acquisitions; // Acquisitions that found the lock held
+    size_t spin_acquisitions; // Contended acquisitions that got the lock while spinning
+    size_t futex_waits; // Times a thread slept in the kernel waiting for a lock
+};
+
+// Bump allocator whose objects are all released at once, see optiheap_region_create
+struct optiheap_region;
+
+// Allocator of same-sized objects packed into shared chunks, see optiheap_pool_create
+struct optiheap_pool;
+
 void optiheap_allocator_init(void);
 void* optiheap_allocate(size_t size);
+void* optiheap_calloc(size_t nmemb, size_t size);
+void* optiheap_allocate_flags(size_t size, unsigned int flags);
+void* optiheap_aligned_allocate(size_t alignment, size_t size);
+int optiheap_posix_memalign(void **memptr, size_t alignment, size_t size);
 void* optiheap_free(void* ptr);
+void* optiheap_free_sized(void *ptr, size_t size);
+size_t optiheap_allocate_batch(size_t size, size_t count, void **out);
+size_t optiheap_free_batch(void **ptrs, size_t count);
+void* optiheap_reallocate(void *ptr, size_t size);
+size_t optiheap_usable_size(void *ptr);
+int optiheap_trim(size_t pad);
+int optiheap_reserve(size_t bytes, size_t object_size);
+int optiheap_warmup(const struct optiheap_warmup_class *classes, size_t count);
 void debug_print_heap(int debug_id);
 void debug_print_mmap(int debug_id);
+void debug_print_slab(int debug_id);
 void* optiheap_reference_allocate(size_t size, void (*destructor)(void *));
 void optiheap_retain(void *ptr);
 void* optiheap_release(void *ptr);
 size_t optiheap_reference_count(void *ptr);
 int optiheap_verify_reference_counting(void);
+int optiheap_set_option(enum optiheap_option option, size_t value);
+size_t optiheap_get_option(enum optiheap_option option);
+int optiheap_get_arena_stats(size_t index, struct optiheap_arena_stats *stats);
+int optiheap_get_huge_page_stats(struct optiheap_huge_page_stats *stats);
+int optiheap_get_lock_stats(struct optiheap_lock_stats *stats);
+struct optiheap_region* optiheap_region_create(size_t chunk_size);
+void* optiheap_region_alloc(struct optiheap_region *region, size_t size);
+void optiheap_region_reset(struct optiheap_region *region);
+void optiheap_region_destroy(struct optiheap_region *region);
+struct optiheap_pool* optiheap_pool_create(size_t object_size, size_t alignment);
+void* optiheap_pool_alloc(struct optiheap_pool *pool);
+void* optiheap_pool_free(struct optiheap_pool *pool, void *ptr);
+void optiheap_pool_destroy(struct optiheap_pool *pool);
 
 #endif // OPTIHEAP
\ No newline at end of file
@@ -0,0 +1,93 @@
+#define _GNU_SOURCE // syscall and the futex constants are Linux extensions
+#include "adaptive_lock.h"
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/*
+ * This file implements the slow paths of the adaptive lock: bounded spinning, sleeping on the
+ * futex once spinning gave up, and waking a sleeper on release.
+ * Builds with OPTIHEAP_LOCK_STATS count contended acquisitions and how each one ended,
+ * the fast paths in adaptive_lock.h are never counted.
+ */
+
+int adaptive_lock_threaded = 0; // Set once a second thread was seen, see adaptive_lock_elided
+static uint32_t max_spins = UINT32_MAX; // Spin cap for this machine, set on the first contended acquisition
+
+#ifdef OPTIHEAP_LOCK_STATS
+static size_t contended_acquisitions;
+static size_t spin_acquisitions;
+static size_t futex_waits;
+#define COUNT_LOCK_EVENT(counter) __atomic_fetch_add(&(counter), 1, __ATOMIC_RELAXED)
+#else
+#define COUNT_LOCK_EVENT(counter) ((void)0)
+#endif
+
+
+void adaptive_lock_init(struct adaptive_lock *lock)
+{
+    lock->state = ADAPTIVE_LOCK_FREE;
+    lock->spins = 0;
+}
+
+
+/*
+ * This function waits for a lock its fast path found held, and takes it.
+ * It spins up to twice the lock's average plus a margin, capped at OPTIHEAP_LOCK_MAX_SPINS,
+ * then marks the lock as having waiters and sleeps on the futex until a release hands it over.
+ * The spins the acquisition needed, or the full budget if it had to sleep, feed the average.
+ */
+void adaptive_lock_wait(struct adaptive_lock *lock)
+{
+    uint32_t cap = __atomic_load_n(&max_spins, __ATOMIC_RELAXED);
+    if (cap == UINT32_MAX) {
+        cap = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? OPTIHEAP_LOCK_MAX_SPINS : 0; // The holder cannot run while we spin
+        __atomic_store_n(&max_spins, cap, __ATOMIC_RELAXED);
+    }
+    COUNT_LOCK_EVENT(contended_acquisitions);
+
+    uint32_t spins = __atomic_load_n(&lock->spins, __ATOMIC_RELAXED);
+    uint32_t limit = spins * 2 + 10 < cap ? spins * 2 + 10 : cap;
+    uint32_t count = 0;
+    for (; count < limit; count++) {
+        ADAPTIVE_LOCK_PAUSE();
+        if (__atomic_load_n(&lock->state, __ATOMIC_RELAXED) == ADAPTIVE_LOCK_FREE && adaptive_lock_try(lock)) {
+            COUNT_LOCK_EVENT(spin_acquisitions);
+            goto END;
+        }
+    }
+
+    // A thread that takes the lock by exchange cannot tell whether others sleep, so it always leaves the waiters mark
+    while (__atomic_exchange_n(&lock->state, ADAPTIVE_LOCK_WAITERS, __ATOMIC_ACQUIRE) != ADAPTIVE_LOCK_FREE) {
+        COUNT_LOCK_EVENT(futex_waits);
+        syscall(SYS_futex, &lock->state, FUTEX_WAIT_PRIVATE, ADAPTIVE_LOCK_WAITERS, NULL, NULL, 0);
+    }
+
+END:
+    spins = lock->spins; // Updated under the lock, so no acquisition's sample is lost
+    __atomic_store_n(&lock->spins, (uint32_t)((int32_t)spins + ((int32_t)count - (int32_t)spins) / 8), __ATOMIC_RELAXED);
+}
+
+
+void adaptive_lock_wake(struct adaptive_lock *lock)
+{
+    syscall(SYS_futex, &lock->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+
+/*
+ * This function fills stats with the contention seen by every adaptive lock since the process started.
+ * It returns 0 on success, or -1 if the counters are not compiled in.
+ */
+int adaptive_lock_get_stats([[maybe_unused]]struct optiheap_lock_stats *stats)
+{
+    #ifdef OPTIHEAP_LOCK_STATS
+    stats->contended_acquisitions = __atomic_load_n(&contended_acquisitions, __ATOMIC_RELAXED);
+    stats->spin_acquisitions = __atomic_load_n(&spin_acquisitions, __ATOMIC_RELAXED);
+    stats->futex_waits = __atomic_load_n(&futex_waits, __ATOMIC_RELAXED);
+    return 0;
+    #else
+    return -1;
+    #endif
+}
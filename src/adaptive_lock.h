@@ -0,0 +1,114 @@
+#ifndef ADAPTIVE_LOCK_H
+#define ADAPTIVE_LOCK_H
+
+#include <stdint.h>
+#include "../include/optiheap_allocator.h"
+
+/*
+ * The adaptive lock guards the allocator's short critical sections. It is a futex word that is
+ * taken with one compare-and-swap when free. A thread finding it held spins for a while, as the
+ * holder usually leaves within a few hundred cycles, and only sleeps in the kernel when that fails.
+ * Each lock keeps a running average of the spins its contended acquisitions needed and spins up to
+ * about twice that, so locks held for long stop spinning and quickly handed over ones keep doing it.
+ */
+#define ADAPTIVE_LOCK_FREE 0
+#define ADAPTIVE_LOCK_HELD 1
+#define ADAPTIVE_LOCK_WAITERS 2 // Held, and threads may be sleeping on the futex
+
+// Upper bound on the spins of one acquisition, machines with a single CPU never spin
+#ifndef OPTIHEAP_LOCK_MAX_SPINS
+#define OPTIHEAP_LOCK_MAX_SPINS 100
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ADAPTIVE_LOCK_PAUSE() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define ADAPTIVE_LOCK_PAUSE() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define ADAPTIVE_LOCK_PAUSE() __atomic_signal_fence(__ATOMIC_SEQ_CST)
+#endif
+
+struct adaptive_lock {
+    uint32_t state; // ADAPTIVE_LOCK_FREE, ADAPTIVE_LOCK_HELD or ADAPTIVE_LOCK_WAITERS
+    uint32_t spins; // Running average of the spins contended acquisitions needed
+};
+
+#define ADAPTIVE_LOCK_INITIALIZER {ADAPTIVE_LOCK_FREE, 0}
+
+/*
+ * While the process has a single thread, locks are not taken at all. glibc 2.32 and later keep
+ * __libc_single_threaded, which pthread_create clears before the second thread exists.
+ * The first lock operation that finds it cleared sets adaptive_lock_threaded, which is never
+ * cleared again, so locking stays on even if glibc later reports a single thread again.
+ * No critical section creates a thread, so the acquire and release of one always agree.
+ * Threads started without pthread_create (a raw clone) are not seen, such programs should be
+ * built with OPTIHEAP_NO_LOCK_ELISION.
+ */
+#if !defined(OPTIHEAP_NO_LOCK_ELISION) && defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 32))
+#include <sys/single_threaded.h>
+#define ADAPTIVE_LOCK_SINGLE_THREADED() __libc_single_threaded
+#else
+#define ADAPTIVE_LOCK_SINGLE_THREADED() 0 // No way to tell, always lock
+#endif
+
+extern int adaptive_lock_threaded;
+
+void adaptive_lock_init(struct adaptive_lock *lock);
+void adaptive_lock_wait(struct adaptive_lock *lock);
+void adaptive_lock_wake(struct adaptive_lock *lock);
+int adaptive_lock_get_stats(struct optiheap_lock_stats *stats);
+
+
+/*
+ * This function tells whether locks can be skipped because the process has never had a second thread.
+ * Once a second thread was seen it costs one load and a branch that is always predicted right.
+ */
+static inline int adaptive_lock_elided(void)
+{
+    if (__builtin_expect(__atomic_load_n(&adaptive_lock_threaded, __ATOMIC_RELAXED), 1)) {
+        return 0;
+    }
+    if (ADAPTIVE_LOCK_SINGLE_THREADED()) {
+        return 1;
+    }
+    __atomic_store_n(&adaptive_lock_threaded, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+
+/*
+ * This function takes the lock if it is free, without waiting.
+ * It returns 1 if the lock was taken, 0 otherwise.
+ */
+static inline int adaptive_lock_try(struct adaptive_lock *lock)
+{
+    uint32_t expected = ADAPTIVE_LOCK_FREE;
+    return __atomic_compare_exchange_n(&lock->state, &expected, ADAPTIVE_LOCK_HELD, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+
+static inline void adaptive_lock_acquire(struct adaptive_lock *lock)
+{
+    if (adaptive_lock_elided()) {
+        return;
+    }
+    if (!adaptive_lock_try(lock)) {
+        adaptive_lock_wait(lock);
+    }
+}
+
+
+/*
+ * This function releases the lock, entering the kernel only when a thread may be sleeping on it.
+ */
+static inline void adaptive_lock_release(struct adaptive_lock *lock)
+{
+    if (adaptive_lock_elided()) {
+        return;
+    }
+    if (__atomic_exchange_n(&lock->state, ADAPTIVE_LOCK_FREE, __ATOMIC_RELEASE) == ADAPTIVE_LOCK_WAITERS) {
+        adaptive_lock_wake(lock);
+    }
+}
+
+#endif // ADAPTIVE_LOCK_H
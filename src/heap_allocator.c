@@ -1,5 +1,9 @@
+#define _DEFAULT_SOURCE // sysconf is not part of strict C99
 #include "memory_structs.h"
 #include "heap_allocator.h"
+#include "page_map.h"
+#include "huge_pages.h"
+#include "prefault.h"
 
 #include <limits.h>
 #include <unistd.h>
@@ -7,359 +11,1564 @@
 #include <stddef.h>
 #include <string.h>
 #include <stdint.h>
+#include <sys/mman.h>
+#ifdef OPTIHEAP_THREAD_SAFE
 #include <pthread.h>
+#endif
+
+struct heap_arena heap_arenas[OPTIHEAP_HEAP_MAX_ARENAS];
+struct heap_segment *heap_segments;
+static struct heap_segment *heap_segments_tail;
+static size_t heap_page_size;
+
+#ifdef OPTIHEAP_THREAD_SAFE
+static struct adaptive_lock heap_segment_mutex = ADAPTIVE_LOCK_INITIALIZER; // Serialises appends to heap_segments
+static size_t heap_arena_count = 1;
+static size_t heap_next_arena = 0;
+static __thread struct heap_arena *thread_arena;
+static pthread_key_t heap_thread_key;
+static pthread_once_t heap_thread_key_once = PTHREAD_ONCE_INIT;
+
+static void heap_thread_exit(void *arena);
+
+static void heap_create_thread_key(void)
+{
+    pthread_key_create(&heap_thread_key, heap_thread_exit);
+}
+#endif
+
+static size_t heap_trim_threshold = OPTIHEAP_HEAP_TRIM_THRESHOLD;
+static size_t heap_release_threshold = OPTIHEAP_HEAP_RELEASE_THRESHOLD;
+
+/*
+ * This function initializes the heap allocator.
+ * It resets every size group of every arena, including its free list index, and spreads
+ * threads over one arena per online CPU when thread safety is enabled.
+ * No segment is reserved until the first block is carved.
+ */
+void heap_allocator_init()
+{
+    memset(heap_arenas, 0, sizeof(heap_arenas));
+    heap_segments = heap_segments_tail = NULL;
+    heap_page_size = (size_t)sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < OPTIHEAP_HEAP_MAX_ARENAS; i++) {
+        for (size_t g = 0; g < HEAP_SIZE_GROUPS; g++) {
+            heap_arenas[i].groups[g].arena = &heap_arenas[i];
+            #ifdef OPTIHEAP_THREAD_SAFE
+            adaptive_lock_init(&heap_arenas[i].groups[g].mutex);
+            #endif
+        }
+    }
+    #ifdef OPTIHEAP_THREAD_SAFE
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    heap_arena_count = cpus < 1 ? 1 : (size_t)cpus < OPTIHEAP_HEAP_MAX_ARENAS ? (size_t)cpus : OPTIHEAP_HEAP_MAX_ARENAS;
+    #endif
+}
+
+
+/*
+ * This function returns the arena of the calling thread, assigning the next arena
+ * round-robin on the thread's first call. The arena is recorded under a pthread key,
+ * so that heap_thread_exit detaches the thread from it when the thread exits.
+ */
+static struct heap_arena* current_arena(void)
+{
+    #ifdef OPTIHEAP_THREAD_SAFE
+    struct heap_arena *arena = thread_arena;
+    if (!arena) {
+        size_t index = __atomic_fetch_add(&heap_next_arena, 1, __ATOMIC_RELAXED) % heap_arena_count;
+        arena = &heap_arenas[index];
+        __atomic_fetch_add(&arena->thread_count, 1, __ATOMIC_SEQ_CST);
+        thread_arena = arena; // Set first, registering the key may allocate through an interposed malloc
+        pthread_once(&heap_thread_key_once, heap_create_thread_key);
+        pthread_setspecific(heap_thread_key, arena);
+    }
+    return arena;
+    #else
+    return &heap_arenas[0];
+    #endif
+}
+
+
+/*
+ * This function returns the index of the size group serving blocks of aligned_size bytes.
+ */
+size_t heap_size_group(size_t aligned_size)
+{
+    size_t index = 0;
+    size_t limit = HEAP_SIZE_GROUP_BASE;
+    while (index + 1 < HEAP_SIZE_GROUPS && aligned_size > limit) {
+        index++;
+        limit <<= HEAP_SIZE_GROUP_SHIFT;
+    }
+    return index;
+}
+
+
+/*
+ * This function returns the size group of the calling thread's arena serving blocks of aligned_size bytes.
+ */
+static struct heap_group* current_group(size_t aligned_size)
+{
+    return &current_arena()->groups[heap_size_group(aligned_size)];
+}
+
+
+/*
+ * This function takes the lock of a size group, counting the acquisitions that had to wait.
+ */
+static void lock_group([[maybe_unused]]struct heap_group *group)
+{
+    #ifdef OPTIHEAP_THREAD_SAFE
+    if (adaptive_lock_elided()) {
+        return;
+    }
+    if (!adaptive_lock_try(&group->mutex)) {
+        adaptive_lock_wait(&group->mutex);
+        group->contention_count++;
+    }
+    #endif
+}
+
+
+static void unlock_group([[maybe_unused]]struct heap_group *group)
+{
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_release(&group->mutex);
+    #endif
+}
+
+
+/*
+ * This function returns the segment owning ptr, or NULL if ptr is not in committed heap memory.
+ * The lookup goes through the page map, so it takes constant time and no lock. Segments are
+ * fully set up before their pages are recorded and are never unmapped, so a concurrent growth
+ * can never make a pointer we handed out look foreign.
+ */
+static struct heap_segment* heap_segment_of(void *ptr)
+{
+    uintptr_t entry = page_map_get(ptr);
+    return PAGE_MAP_KIND(entry) == PAGE_MAP_HEAP ? (struct heap_segment *)PAGE_MAP_OWNER(entry) : NULL;
+}
+
+
+/*
+ * This function checks if a pointer is within the range of the heap memory.
+ * It returns 1 if the pointer is within the committed part of a heap segment, otherwise returns 0.
+ */
+int within_heap_range(void *ptr)
+{
+    return heap_segment_of(ptr) != NULL;
+}
+
+
+/*
+ * This function checks if a block is a heap block of the calling thread's arena, with a single page map lookup.
+ * It returns 1 if it is, otherwise returns 0. Without thread safety every heap block is local.
+ */
+int heap_block_is_local(struct memory_header *block)
+{
+    struct heap_segment *segment = heap_segment_of(block);
+    #ifdef OPTIHEAP_THREAD_SAFE
+    return segment && segment->group->arena == thread_arena;
+    #else
+    return segment != NULL;
+    #endif
+}
+
+
+/*
+ * This function writes the epilogue header at the current end of a segment's blocks.
+ * Segments are page aligned, so storing the segment in the size field leaves the flag bits clear.
+ */
+static void write_epilogue(struct heap_segment *segment)
+{
+    struct memory_header *epilogue = (struct memory_header *)segment->curr;
+    epilogue->size = (size_t)(uintptr_t)segment;
+    epilogue->magic = HEAP_EPILOGUE;
+}
+
+
+/*
+ * This function returns the segment an epilogue header belongs to.
+ */
+static struct heap_segment* epilogue_segment(struct memory_header *epilogue)
+{
+    return (struct heap_segment *)(uintptr_t)epilogue->size;
+}
+
+
+/*
+ * This function makes the segment read/write up to at least needed_end, committing
+ * whole OPTIHEAP_HEAP_COMMIT_STEP steps so that a run of small allocations does not
+ * make one mprotect call each. Segments meant for huge pages commit whole huge pages,
+ * since a partly committed huge page cannot be backed by one. Committed pages are recorded in the page map
+ * until trim_segment_tail decommits them again.
+ * It returns 1 on success, or 0 if needed_end lies beyond the reserved range or mprotect failed.
+ */
+static int commit_segment(struct heap_segment *segment, char *needed_end)
+{
+    if (needed_end <= segment->commit_end) {
+        return 1;
+    }
+    if (needed_end > segment->end) {
+        return 0;
+    }
+
+    uintptr_t step_mask = (segment->huge ? HUGE_PAGE_SIZE : OPTIHEAP_HEAP_COMMIT_STEP) - 1;
+    char *new_commit_end = (char *)(((uintptr_t)needed_end + step_mask) & ~step_mask);
+    if (new_commit_end > segment->end) {
+        new_commit_end = segment->end;
+    }
+    size_t length = (size_t)(new_commit_end - segment->commit_end);
+    if (mprotect(segment->commit_end, length, PROT_READ | PROT_WRITE) != 0) {
+        fprintf(stderr, "Error: mprotect failed to commit %zu bytes of heap\n", length);
+        return 0;
+    }
+    // Pages are only recorded once they are accessible, so the page map never points at uncommitted memory
+    if (page_map_set(segment->commit_end, length, segment, PAGE_MAP_HEAP) != 0) {
+        mprotect(segment->commit_end, length, PROT_NONE);
+        return 0;
+    }
+    segment->group->committed_size += length;
+    segment->commit_end = new_commit_end;
+    return 1;
+}
+
+
+/*
+ * This function reserves a new segment of group with room for a block of at least block_size bytes
+ * and appends it to the global segment list. Linking it into the group is left to link_segment,
+ * so it runs without the group's lock.
+ * With huge pages enabled the segment is 2 MiB aligned and advised to use transparent huge pages.
+ * It returns the new segment, or NULL if the address space could not be reserved.
+ */
+static struct heap_segment* create_heap_segment(struct heap_group *group, size_t block_size)
+{
+    size_t needed = HEAP_SEGMENT_HEADER_SIZE + block_size + sizeof(struct memory_header);
+    size_t reserve_size = OPTIHEAP_HEAP_SEGMENT_SIZE;
+    if (needed > reserve_size) {
+        reserve_size = (needed + OPTIHEAP_HEAP_SEGMENT_SIZE - 1) & ~(OPTIHEAP_HEAP_SEGMENT_SIZE - 1);
+    }
+
+    int huge = huge_page_mode != OPTIHEAP_HUGE_PAGES_OFF;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+    char *base = huge ? huge_page_map(reserve_size, PROT_NONE, flags, NULL) : mmap(NULL, reserve_size, PROT_NONE, flags, -1, 0);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Error: mmap failed to reserve %zu bytes of heap\n", reserve_size);
+        return NULL;
+    }
+
+    // The bookkeeping itself lives in the segment, so its first step is committed by hand
+    size_t first_commit = huge ? HUGE_PAGE_SIZE : OPTIHEAP_HEAP_COMMIT_STEP;
+    if (first_commit > reserve_size) {
+        first_commit = reserve_size;
+    }
+    if (mprotect(base, first_commit, PROT_READ | PROT_WRITE) != 0) {
+        fprintf(stderr, "Error: mprotect failed to commit %zu bytes of heap\n", first_commit);
+        munmap(base, reserve_size);
+        return NULL;
+    }
+
+    struct heap_segment *segment = (struct heap_segment *)base;
+    if (page_map_set(base, first_commit, segment, PAGE_MAP_HEAP) != 0) {
+        munmap(base, reserve_size);
+        return NULL;
+    }
+    segment->next = NULL;
+    segment->group_next = NULL;
+    segment->group = group;
+    segment->curr = base + HEAP_SEGMENT_HEADER_SIZE;
+    segment->pristine = segment->curr + sizeof(struct memory_header);
+    segment->commit_end = base + first_commit;
+    segment->end = base + reserve_size;
+    segment->huge = (size_t)huge;
+    write_epilogue(segment);
+
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_acquire(&heap_segment_mutex);
+    #endif
+    *(heap_segments_tail ? &heap_segments_tail->next : &heap_segments) = segment;
+    heap_segments_tail = segment;
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_release(&heap_segment_mutex);
+    #endif
+    return segment;
+}
+
+
+/*
+ * This function carves size bytes from the untouched tail of a segment, committing memory
+ * as needed and moving the epilogue behind the carved range.
+ * It returns the start of the carved range, or NULL if the segment has no room for it.
+ */
+static char* extend_segment(struct heap_segment *segment, size_t size)
+{
+    if ((size_t)(segment->end - segment->curr) < size + sizeof(struct memory_header) ||
+        !commit_segment(segment, segment->curr + size + sizeof(struct memory_header))) {
+        return NULL;
+    }
+    char *result = segment->curr;
+    segment->curr += size;
+    write_epilogue(segment);
+    // The epilogue is left behind when the tail retreats, so the watermark covers it as well.
+    // The tail may retreat later, this watermark only drops on decommit.
+    if (segment->curr + sizeof(struct memory_header) > segment->pristine) {
+        segment->pristine = segment->curr + sizeof(struct memory_header);
+    }
+    return result;
+}
+
+
+/*
+ * This function appends a segment made by create_heap_segment to the segment list of its group.
+ * The caller must hold the group's lock when thread safety is enabled.
+ */
+static void link_segment(struct heap_group *group, struct heap_segment *segment)
+{
+    if (group->last_segment) {
+        group->last_segment->group_next = segment;
+    } else {
+        group->segments = segment;
+    }
+    group->last_segment = segment;
+    group->segment_count++;
+    group->committed_size += (size_t)(segment->commit_end - (char *)segment);
+}
+
+
+/*
+ * This function returns the oldest segment of group whose untouched tail has room for
+ * block_size bytes, reserving a new segment if none has.
+ * Growing the heap maps memory, so the group's lock is dropped while the segment is reserved:
+ * the group's other threads keep allocating and freeing meanwhile, and only the append to the
+ * global segment list is serialised. The free lists may have changed when it returns, and at worst
+ * two threads of the group each reserve a segment, the spare one serves the group's later growth.
+ * The caller must hold the group's lock when thread safety is enabled.
+ * It returns the segment, or NULL if the address space could not be reserved.
+ */
+static struct heap_segment* segment_with_room(struct heap_group *group, size_t block_size)
+{
+    struct heap_segment *segment = group->segments;
+    while (segment && (size_t)(segment->end - segment->curr) < block_size + sizeof(struct memory_header)) {
+        segment = segment->group_next;
+    }
+    if (segment) {
+        return segment;
+    }
+
+    unlock_group(group);
+    segment = create_heap_segment(group, block_size);
+    lock_group(group);
+    if (segment) {
+        link_segment(group, segment);
+    }
+    return segment;
+}
+
+
+/*
+ * This function attempts to allocate a block of memory from the untouched tail of a segment of group.
+ * If pristine is not NULL, it receives the segment's zero-fill watermark from before the carve.
+ * It returns the start of the block, or ALLOCATION_FAILED.
+ */
+static void* try_heap_allocation(struct heap_group *group, size_t block_size, char **pristine)
+{
+    struct heap_segment *segment = segment_with_room(group, block_size);
+    if (!segment) {
+        return ALLOCATION_FAILED;
+    }
+
+    char *watermark = segment->pristine;
+    char *result = extend_segment(segment, block_size);
+    if (!result) {
+        return ALLOCATION_FAILED;
+    }
+    if (pristine) {
+        *pristine = watermark;
+    }
+    return result;
+}
+
+
+/*
+ * This function returns the free-list links stored in the payload of a free block.
+ */
+static struct free_block_links* free_links(struct memory_header *block)
+{
+    return (struct free_block_links *)(block + 1);
+}
+
+
+/*
+ * This function returns the header physically following block, which is the segment's
+ * epilogue if block is the last block of its segment.
+ */
+static struct memory_header* physical_successor(struct memory_header *block)
+{
+    return (struct memory_header *)((char *)(block + 1) + BLOCK_SIZE(block));
+}
+
+
+/*
+ * This function returns the physically next block, or NULL if block is the last one of its segment.
+ */
+static struct memory_header* next_physical_block(struct memory_header *block)
+{
+    struct memory_header *next = physical_successor(block);
+    return next->magic != HEAP_EPILOGUE ? next : NULL;
+}
+
+
+/*
+ * This function returns the physically previous block.
+ * It may only be called when block has BLOCK_PREV_FREE set, since only free blocks have a footer.
+ */
+static struct memory_header* prev_physical_block(struct memory_header *block)
+{
+    size_t prev_size = *((size_t *)block - 1);
+    return (struct memory_header *)((char *)block - prev_size) - 1;
+}
+
+
+/*
+ * This function writes the footer of a free block, a copy of its size in the last word of its payload.
+ */
+static void write_footer(struct memory_header *block)
+{
+    *(size_t *)((char *)(block + 1) + BLOCK_SIZE(block) - sizeof(size_t)) = BLOCK_SIZE(block);
+}
+
+
+/*
+ * This function returns the first block of segment or of any later segment, or NULL if they are all empty.
+ */
+static struct memory_header* first_block_from(struct heap_segment *segment)
+{
+    for (; segment; segment = segment->next) {
+        char *first = (char *)segment + HEAP_SEGMENT_HEADER_SIZE;
+        if (first < segment->curr) {
+            return (struct memory_header *)first;
+        }
+    }
+    return NULL;
+}
+
+
+/*
+ * This function returns the first block of the heap, or NULL if the heap is empty.
+ */
+struct memory_header* heap_first_block(void)
+{
+    return first_block_from(heap_segments);
+}
+
+
+/*
+ * This function returns the block following block, moving on to the next segment
+ * after the last block of a segment, or NULL at the end of the heap.
+ */
+struct memory_header* heap_next_block(struct memory_header *block)
+{
+    struct memory_header *next = physical_successor(block);
+    if (next->magic != HEAP_EPILOGUE) {
+        return next;
+    }
+    return first_block_from(epilogue_segment(next)->next);
+}
+
+
+/*
+ * This function returns the index of the most significant set bit of a non-zero size.
+ */
+static size_t find_last_set(size_t size)
+{
+    return (sizeof(size_t) * CHAR_BIT - 1) - (size_t)__builtin_clzl(size);
+}
+
+
+/*
+ * This function calculates the two-level free list index a block of the given size belongs to.
+ * Sizes below SMALL_BLOCK_SIZE map linearly into first level 0, larger sizes map to
+ * first level log2(size) and second level by the next SL_INDEX_COUNT_LOG2 bits.
+ */
+static void get_free_list_index(size_t size, size_t *fl, size_t *sl)
+{
+    if (size < SMALL_BLOCK_SIZE) {
+        *fl = 0;
+        *sl = size / (SMALL_BLOCK_SIZE / SL_INDEX_COUNT);
+        return;
+    }
+    size_t last_set = find_last_set(size);
+    if (last_set > FL_INDEX_MAX) {
+        // Oversized blocks all share the last list
+        *fl = FL_INDEX_COUNT - 1;
+        *sl = SL_INDEX_COUNT - 1;
+        return;
+    }
+    *sl = (size >> (last_set - SL_INDEX_COUNT_LOG2)) ^ ((size_t)1 << SL_INDEX_COUNT_LOG2);
+    *fl = last_set - (FL_INDEX_SHIFT - 1);
+}
+
+
+/*
+ * This function calculates the first list whose every block is large enough for size.
+ * The size is rounded up to the next list boundary before it is classified, so the head
+ * of any non-empty list at or after the returned index is a fit and no list is searched.
+ */
+static void get_search_index(size_t size, size_t *fl, size_t *sl)
+{
+    if (size >= SMALL_BLOCK_SIZE) {
+        size_t round = ((size_t)1 << (find_last_set(size) - SL_INDEX_COUNT_LOG2)) - 1;
+        size += round;
+    }
+    get_free_list_index(size, fl, sl);
+}
+
+
+/*
+ * This function finds the first non-empty free list at or after (fl, sl) using the bitmaps.
+ * It returns the head of that list, or NULL if no large enough block is free.
+ */
+static struct memory_header* find_suitable_block(struct heap_group *group, size_t fl, size_t sl)
+{
+    if (fl >= FL_INDEX_COUNT) {
+        return NULL;
+    }
+
+    uint32_t sl_map = group->sl_bitmap[fl] & (~(uint32_t)0 << sl);
+    if (!sl_map) {
+        // No fitting list in this first level, move on to the next non-empty one
+        uint64_t fl_map = fl + 1 < 64 ? group->fl_bitmap & (~(uint64_t)0 << (fl + 1)) : 0;
+        if (!fl_map) {
+            return NULL;
+        }
+        fl = (size_t)__builtin_ctzll(fl_map);
+        sl_map = group->sl_bitmap[fl];
+    }
+    sl = (size_t)__builtin_ctz(sl_map);
+    return group->free_head[fl][sl];
+}
+
+
+/*
+ * This function inserts a block at the head of its free list.
+ * It updates the pointers accordingly to maintain the doubly linked list structure,
+ * and marks the list as non-empty in both bitmaps.
+ */
+void insert_into_free_list(struct heap_group *group, struct memory_header *block) {
+    size_t fl, sl;
+    get_free_list_index(BLOCK_SIZE(block), &fl, &sl);
+    struct free_block_links *links = free_links(block);
+    links->prev_free = NULL;
+    links->next_free = group->free_head[fl][sl];
+    if (links->next_free) {
+        free_links(links->next_free)->prev_free = block;
+    }
+    group->free_head[fl][sl] = block;
+    group->fl_bitmap |= (uint64_t)1 << fl;
+    group->sl_bitmap[fl] |= (uint32_t)1 << sl;
+    group->free_size += BLOCK_SIZE(block);
+}
+
+
+/*
+ * This function removes a block from the free list.
+ * It updates the pointers accordingly to maintain the doubly linked list structure.
+ * If the block is the head of the free list, it updates the head and clears the bitmap bits of an emptied list.
+ * It clears the block's links since it is no longer a part of free list.
+ */
+void remove_from_free_list(struct heap_group *group, struct memory_header *block) {
+    size_t fl, sl;
+    get_free_list_index(BLOCK_SIZE(block), &fl, &sl);
+    struct free_block_links *links = free_links(block);
+    if (links->prev_free) {
+        free_links(links->prev_free)->next_free = links->next_free;
+    } else {
+        group->free_head[fl][sl] = links->next_free;
+        if (!links->next_free) {
+            group->sl_bitmap[fl] &= ~((uint32_t)1 << sl);
+            if (!group->sl_bitmap[fl]) {
+                group->fl_bitmap &= ~((uint64_t)1 << fl);
+            }
+        }
+    }
+    if (links->next_free) {
+        free_links(links->next_free)->prev_free = links->prev_free;
+    }
+    links->next_free = links->prev_free = NULL;
+    group->free_size -= BLOCK_SIZE(block);
+}
+
+
+/*
+ * This function returns the whole pages inside [from, to) that belong to the interior of a
+ * free block, i.e. neither its free-list links nor its footer, to the OS with madvise.
+ * MADV_DONTNEED is used rather than MADV_FREE so that the drop shows in RSS right away.
+ * Nothing is released if the range holds fewer than min_length bytes of whole pages.
+ * Segments meant for huge pages only release whole huge pages, so that a block freed
+ * in the middle of a huge page does not make the kernel split it.
+ * The caller must hold the group's lock when thread safety is enabled.
+ * It returns 1 if pages were released, otherwise returns 0.
+ */
+static int release_free_pages(struct memory_header *block, char *from, char *to, size_t min_length)
+{
+    char *interior_start = (char *)(block + 1) + sizeof(struct free_block_links);
+    char *interior_end = (char *)(block + 1) + BLOCK_SIZE(block) - sizeof(size_t);
+    if (from < interior_start) {
+        from = interior_start;
+    }
+    if (to > interior_end) {
+        to = interior_end;
+    }
+
+    struct heap_segment *segment = PAGE_MAP_OWNER(page_map_get(block));
+    uintptr_t page_mask = (segment->huge ? HUGE_PAGE_SIZE : heap_page_size) - 1;
+    char *start = (char *)(((uintptr_t)from + page_mask) & ~page_mask);
+    char *end = (char *)((uintptr_t)to & ~page_mask);
+    if (end <= start || (size_t)(end - start) < min_length) {
+        return 0;
+    }
+
+    return madvise(start, (size_t)(end - start), MADV_DONTNEED) == 0;
+}
+
+
+/*
+ * This function decommits the untouched tail of a segment, keeping pad bytes after its last
+ * block committed so that the next allocations do not commit them again right away.
+ * The range is replaced by a fresh PROT_NONE mapping, which drops its pages and its commit charge,
+ * and its pages leave the page map, so a stale pointer into it is rejected before its header is read.
+ * Segments meant for huge pages stay committed up to a huge page boundary, and the fresh
+ * mapping is advised again since it does not inherit the advice.
+ * The caller must hold the group's lock when thread safety is enabled.
+ * It returns 1 if memory was released, otherwise returns 0.
+ */
+static int trim_segment_tail(struct heap_segment *segment, size_t pad)
+{
+    uintptr_t page_mask = (segment->huge ? HUGE_PAGE_SIZE : heap_page_size) - 1;
+    char *new_commit_end = (char *)(((uintptr_t)segment->curr + sizeof(struct memory_header) + pad + page_mask) & ~page_mask);
+    if (new_commit_end >= segment->commit_end) {
+        return 0;
+    }
+    size_t length = (size_t)(segment->commit_end - new_commit_end);
+    if (mmap(new_commit_end, length, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED) {
+        return 0;
+    }
+    if (segment->huge) {
+        madvise(new_commit_end, length, MADV_HUGEPAGE);
+    }
+    page_map_clear(new_commit_end, length);
+
+    segment->group->committed_size -= length;
+    segment->commit_end = new_commit_end;
+    if (segment->pristine > new_commit_end) {
+        segment->pristine = new_commit_end; // Pages committed again later are fresh from the kernel
+    }
+    return 1;
+}
+
+
+/*
+ * This function coalesces adjacent free blocks in the heap.
+ * The previous block is only touched when the BLOCK_PREV_FREE bit says it is free, and is
+ * found through its footer; the next block is found by size arithmetic.
+ * Free neighbours are merged into a single block which is inserted back into the free list.
+ * A block that ends up last in its segment is absorbed into the segment's untouched tail instead.
+ * This is important for efficient memory management and to reduce fragmentation.
+ */
+void coalesce_free_blocks(struct heap_group *group, struct memory_header *block) {
+
+    // Only the pages of the block being freed can be resident, its free neighbours were released already
+    char *freed_start = (char *)block;
+    char *freed_end = (char *)(block + 1) + BLOCK_SIZE(block);
+    
+    // Check and merge with previous block if it is free
+    if (block->size & BLOCK_PREV_FREE) {
+        struct memory_header *prev = prev_physical_block(block);
+        remove_from_free_list(group, prev);
+        prev->size += sizeof(struct memory_header) + BLOCK_SIZE(block);
+        block = prev;
+    }
+
+    // Check and merge with next block if it is free
+    struct memory_header *next = physical_successor(block);
+    if (next->magic == HEAP_FREED) {
+        remove_from_free_list(group, next);
+        block->size += sizeof(struct memory_header) + BLOCK_SIZE(next);
+        next = physical_successor(block);
+    }
+
+    if (next->magic == HEAP_EPILOGUE) {
+        struct heap_segment *segment = epilogue_segment(next);
+        segment->curr = (char *)block; // Give the block back to the untouched tail
+        write_epilogue(segment);
+        if ((size_t)(segment->pristine - segment->curr) > heap_trim_threshold) {
+            trim_segment_tail(segment, OPTIHEAP_HEAP_TOP_PAD);
+        }
+        return;
+    }
+
+    write_footer(block);
+    next->size |= BLOCK_PREV_FREE;
+    insert_into_free_list(group, block);
+
+    if (BLOCK_SIZE(block) >= heap_release_threshold) {
+        release_free_pages(block, freed_start, freed_end, OPTIHEAP_HEAP_RELEASE_MIN);
+    }
+}
+ 
+
+/*
+ * This function carves a block of aligned_size bytes out of the free lists or,
+ * failing that, out of fresh heap memory.
+ * If pristine is not NULL, it receives the address from which the block's memory is known
+ * to be zero, which lies at or beyond the end of the block for a recycled block.
+ * The caller must hold the group's lock when thread safety is enabled.
+ * It returns the header of the allocated block, or ALLOCATION_FAILED.
+ */
+static struct memory_header* allocate_heap_block_unlocked(struct heap_group *group, size_t aligned_size, char **pristine)
+{
+    // The head of the list aligned_size itself maps to often fits already,
+    // otherwise the rounded-up search index guarantees a fit in O(1)
+    size_t fl, sl;
+    get_free_list_index(aligned_size, &fl, &sl);
+    struct memory_header *fit = group->free_head[fl][sl];
+    if (!fit || BLOCK_SIZE(fit) < aligned_size) {
+        get_search_index(aligned_size, &fl, &sl);
+        fit = find_suitable_block(group, fl, sl);
+    }
+
+    if (fit) {
+        size_t excess = BLOCK_SIZE(fit) - aligned_size;
+        
+        remove_from_free_list(group, fit); // Remove from free list
+        fit->magic = HEAP_ALLOCATED; // Mark as allocated
+        
+        // if there's excess, we split the block to use the excess space later
+        if (excess >= sizeof(struct memory_header) + HEAP_MIN_PAYLOAD) {
+
+            // Shrink the fitting block, its flags stay as they are
+            fit->size = aligned_size | (fit->size & BLOCK_FLAGS_MASK);
+            
+            // Create a new free block for the excess space, the block after it already knows its predecessor is free
+            struct memory_header *new_free = (struct memory_header *)((char *)(fit + 1) + aligned_size);
+            new_free->size = excess - sizeof(struct memory_header);
+            new_free->magic = HEAP_FREED;
+            write_footer(new_free);
+            insert_into_free_list(group, new_free);
+        } else {
+            struct memory_header *next = next_physical_block(fit);
+            if (next) {
+                next->size &= ~BLOCK_PREV_FREE;
+            }
+        }
+
+        if (pristine) {
+            *pristine = (char *)(fit + 1) + BLOCK_SIZE(fit);
+        }
+        return fit;
+    }
+
+    // No suitable free block, carve a new one from the untouched tail of a segment.
+    // The last block of a segment is never free, so the new block has no free predecessor.
+    struct memory_header *new_block = (struct memory_header *)try_heap_allocation(group, aligned_size + sizeof(struct memory_header), pristine);
+    
+    if(new_block == ALLOCATION_FAILED) {
+        fprintf(stderr, "Error: Unable to allocate %zu bytes from heap\n", aligned_size + sizeof(struct memory_header));
+        return ALLOCATION_FAILED; // Allocation failed
+    }
+    
+    memset(new_block, 0, sizeof(struct memory_header)); // Initialize the new block
+    new_block->magic = HEAP_ALLOCATED;
+    new_block->size = aligned_size; // Set the size of the allocated block
+
+    return new_block;
+}
+
+
+/*
+ * This function trims an allocated block down to aligned_size bytes.
+ * If the tail is large enough to stand on its own, it becomes a free block that is
+ * coalesced with a free successor (or absorbed into the untouched tail of its segment).
+ * The caller must hold the group's lock when thread safety is enabled.
+ */
+static void split_heap_block(struct heap_group *group, struct memory_header *block, size_t aligned_size)
+{
+    size_t excess = BLOCK_SIZE(block) - aligned_size;
+    if (excess < sizeof(struct memory_header) + HEAP_MIN_PAYLOAD) {
+        return; // Too small to be a block of its own, it stays part of the allocation
+    }
+
+    block->size = aligned_size | (block->size & BLOCK_FLAGS_MASK);
+
+    struct memory_header *tail = (struct memory_header *)((char *)(block + 1) + aligned_size);
+    tail->size = excess - sizeof(struct memory_header);
+    tail->magic = HEAP_FREED;
+    coalesce_free_blocks(group, tail);
+}
+
+
+/*
+ * This function returns an allocated block to the free lists.
+ * It validates the magic number, marks the block as free and coalesces it with its neighbours.
+ * The caller must hold the group's lock when thread safety is enabled.
+ */
+static void* free_heap_block_unlocked(struct heap_group *group, struct memory_header *block)
+{
+    if (block->magic != HEAP_ALLOCATED) {
+        fprintf(stderr, "Error: Magic Number -> %x, expected %x for pointer %p\n", 
+                block->magic, HEAP_ALLOCATED, (void *)(block + 1));
+        fprintf(stderr, "Error: Attempt to free invalid or corrupted pointer %p\n", (void *)(block + 1));
+        return DEALLOCATION_FAILED;
+    }
+
+    block->magic = HEAP_FREED; // This helps to identify the block as free
+    
+    // Coalesce with adjacent free blocks and insert into free list
+    coalesce_free_blocks(group, block);
+    return NULL;
+}
+
+
+/*
+ * This function returns the blocks other threads pushed onto a size group's remote-free queue
+ * to its free lists. The whole queue is detached with a single exchange, so producers keep
+ * pushing onto an empty queue while the batch is freed.
+ * The caller must hold the group's lock.
+ */
+static void drain_remote_frees([[maybe_unused]]struct heap_group *group)
+{
+    #ifdef OPTIHEAP_THREAD_SAFE
+    if (!__atomic_load_n(&group->remote_free, __ATOMIC_RELAXED)) {
+        return;
+    }
+    void *ptr = __atomic_exchange_n(&group->remote_free, NULL, __ATOMIC_ACQUIRE);
+    while (ptr) {
+        void *next = *(void **)ptr;
+        struct memory_header *block = (struct memory_header *)ptr - 1;
+        block->magic = HEAP_ALLOCATED;
+        free_heap_block_unlocked(group, block);
+        group->remote_free_count++;
+        ptr = next;
+    }
+    #endif
+}
+
+
+#ifdef OPTIHEAP_THREAD_SAFE
+/*
+ * This function is the pthread key destructor of a thread that used the heap, it runs when the thread exits.
+ * The thread leaves its arena, and the blocks other threads queued on the arena's size groups are
+ * freed now instead of waiting for an allocation that may never come. Once an arena has no live
+ * threads, other arenas' threads free its blocks directly (see free_remote_block).
+ * thread_arena is kept, so the thread cache flushed by a later destructor still frees its blocks as local ones.
+ */
+static void heap_thread_exit(void *arg)
+{
+    struct heap_arena *arena = arg;
+    __atomic_fetch_sub(&arena->thread_count, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST); // Pairs with the one in free_remote_block
+    for (size_t g = 0; g < HEAP_SIZE_GROUPS; g++) {
+        lock_group(&arena->groups[g]);
+        drain_remote_frees(&arena->groups[g]);
+        unlock_group(&arena->groups[g]);
+    }
+}
+#endif
+
+
+/*
+ * This function allocates a block of memory from the heap.
+ * It first looks up a suitable free block in constant time through the two-level index.
+ * If a suitable block is found, it splits the block if it is much larger than needed.
+ * If no suitable block is found, it carves a new block from the committed tail of a heap segment.
+ * It returns a pointer to the allocated memory, or ALLOCATION_FAILED if allocation fails.
+ * The function also handles alignment of the requested size to ensure proper memory alignment.
+ */
+void* allocate_heap_block(size_t requested_size)
+{
+    if (requested_size == 0) {
+        return NULL; // No allocation for zero size
+    }
 
-#define GROWTH_FACTOR 3
+    size_t aligned_size = HEAP_ALIGN(requested_size);
+    struct heap_group *group = current_group(aligned_size);
 
-void *sbrk(intptr_t increment); 
- 
-struct heap_memory_list heap_list;
+    lock_group(group);
+    drain_remote_frees(group);
+    struct memory_header *block = allocate_heap_block_unlocked(group, aligned_size, NULL);
+    unlock_group(group);
+
+    if (block == ALLOCATION_FAILED) {
+        return ALLOCATION_FAILED;
+    }
+    return (void *)(block + 1); // Return pointer to the data area
+}
 
-#ifdef OPTIHEAP_THREAD_SAFE
-pthread_mutex_t heap_mutex = PTHREAD_MUTEX_INITIALIZER;
-#endif
 
 /*
- * This function initializes the heap allocator.
- * It sets the initial state of the heap list, including the head and tail pointers,
- * and the base, current, and end pointers of the heap.
+ * This function allocates a block whose payload is aligned to alignment bytes.
+ * alignment must be a power of two. A block with enough slack to reach an aligned payload
+ * is taken, then the gap in front of the aligned payload is split off as a free block of
+ * its own and the excess behind it is split back as well, so no memory is wasted on padding.
+ * It returns a pointer to the payload, NULL for a zero size, or ALLOCATION_FAILED.
  */
-void heap_allocator_init()
+void* allocate_heap_block_aligned(size_t alignment, size_t requested_size)
 {
-    #ifdef OPTIHEAP_THREAD_SAFE
-    pthread_mutex_lock(&heap_mutex);
-    #endif
-    memset(&heap_list, 0, sizeof(struct heap_memory_list));
-    #ifdef OPTIHEAP_THREAD_SAFE
-    pthread_mutex_unlock(&heap_mutex);
-    #endif
+    if (requested_size == 0) {
+        return NULL; // No allocation for zero size
+    }
+    if (alignment <= HEAP_ALIGNMENT) {
+        return allocate_heap_block(requested_size); // Every payload is already aligned this far
+    }
+
+    size_t aligned_size = HEAP_ALIGN(requested_size);
+    size_t min_gap = sizeof(struct memory_header) + HEAP_MIN_PAYLOAD; // Smallest gap that can stand as a free block
+    struct heap_group *group = current_group(aligned_size);
+
+    lock_group(group);
+    drain_remote_frees(group);
+
+    struct memory_header *block = allocate_heap_block_unlocked(group, aligned_size + alignment + min_gap, NULL);
+    void *result = ALLOCATION_FAILED;
+    if (block == ALLOCATION_FAILED) {
+        goto END;
+    }
+
+    uintptr_t payload = (uintptr_t)(block + 1);
+    uintptr_t aligned_payload = (payload + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    if (aligned_payload != payload && aligned_payload - payload < min_gap) {
+        aligned_payload = (payload + min_gap + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    }
+
+    if (aligned_payload != payload) {
+        size_t gap = aligned_payload - payload;
+        struct memory_header *aligned_block = (struct memory_header *)aligned_payload - 1;
+        memset(aligned_block, 0, sizeof(struct memory_header));
+        aligned_block->magic = HEAP_ALLOCATED;
+        aligned_block->size = BLOCK_SIZE(block) - gap;
+
+        // The leading block keeps the original flags, coalescing marks aligned_block as preceded by a free block
+        block->size = (gap - sizeof(struct memory_header)) | (block->size & BLOCK_FLAGS_MASK);
+        block->magic = HEAP_FREED;
+        coalesce_free_blocks(group, block);
+        block = aligned_block;
+    }
+
+    split_heap_block(group, block, aligned_size);
+    result = (void *)(block + 1);
+
+    END:
+    unlock_group(group);
+    return result;
 }
 
 
 /*
- * This function checks if a pointer is within the range of the heap memory.
- * It returns 1 if the pointer is within the heap range, otherwise returns 0.
+ * This function allocates a block whose first requested_size bytes are zero.
+ * Only the part of the block that was handed out before is cleared: recycled blocks are
+ * cleared completely, while memory carved from freshly committed segment pages is already zero
+ * and costs nothing beyond its page faults.
+ * It returns a pointer to the payload, NULL for a zero size, or ALLOCATION_FAILED.
  */
-int within_heap_range(void *ptr)
+void* allocate_heap_block_zeroed(size_t requested_size)
 {
-    #ifdef OPTIHEAP_THREAD_SAFE
-    pthread_mutex_lock(&heap_mutex);
-    #endif
-    int result = 0;
-    if (ptr >= (void *)heap_list.memory_base && ptr < (void *)heap_list.memory_end) {
-        result = 1;
+    if (requested_size == 0) {
+        return NULL; // No allocation for zero size
     }
-    #ifdef OPTIHEAP_THREAD_SAFE
-    pthread_mutex_unlock(&heap_mutex);
-    #endif
-    return result;
+
+    size_t aligned_size = HEAP_ALIGN(requested_size);
+    struct heap_group *group = current_group(aligned_size);
+
+    lock_group(group);
+    drain_remote_frees(group);
+    char *pristine;
+    struct memory_header *block = allocate_heap_block_unlocked(group, aligned_size, &pristine);
+    unlock_group(group);
+
+    if (block == ALLOCATION_FAILED) {
+        return ALLOCATION_FAILED;
+    }
+
+    // The block belongs to the caller now, so it is cleared outside of the lock
+    char *payload = (char *)(block + 1);
+    char *dirty_end = payload + requested_size;
+    if (dirty_end > pristine) {
+        dirty_end = pristine;
+    }
+    if (dirty_end > payload) {
+        memset(payload, 0, (size_t)(dirty_end - payload));
+    }
+    return payload;
 }
 
 
 /*
- * This function attempts to allocate a block of memory from the heap.
- * If the current heap does not have enough space, it will double the size of the heap
- * until it can accommodate the requested block size.
- * It uses sbrk to request more memory from the system. 
+ * This function allocates up to count blocks of aligned_size bytes from the calling thread's
+ * arena while taking the lock of their size group only once.
+ * The blocks are carved back to back from a single region taken from the free lists or the
+ * untouched tail of a segment, so the free lists are searched once for the whole batch; if no
+ * region that large can be had, the remaining blocks are allocated one at a time.
+ * The payload pointers are written to out and the number of blocks allocated is returned.
+ * aligned_size must already be rounded with HEAP_ALIGN.
  */
-void* try_heap_allocation(size_t block_size)
+size_t allocate_heap_blocks(size_t aligned_size, void **out, size_t count)
 {
-    if (!heap_list.memory_base || (size_t)(heap_list.memory_end - heap_list.memory_curr) < block_size) {
-        size_t curr_size = heap_list.memory_size;
-        size_t new_size = GROWTH_FACTOR * (curr_size + block_size);
-        if (new_size < curr_size + block_size) {
-            new_size = curr_size + block_size;
-        }
-        void* block = (void *)sbrk(new_size - curr_size);
-        if (block == (void *)-1) {
-            fprintf(stderr, "Error: sbrk failed to allocate %zu bytes\n", new_size - curr_size);
-            return ALLOCATION_FAILED; // Indicate failure
+    size_t allocated = 0;
+    size_t stride = sizeof(struct memory_header) + aligned_size;
+    struct heap_group *group = current_group(aligned_size);
+
+    lock_group(group);
+    drain_remote_frees(group);
+
+    if (count > 1 && count <= (SIZE_MAX - aligned_size) / stride) {
+        struct memory_header *block = allocate_heap_block_unlocked(group, count * stride - sizeof(struct memory_header), NULL);
+        if (block != ALLOCATION_FAILED) {
+            // Every block but the last is cut to aligned_size, the last keeps whatever the region had beyond that
+            size_t remaining = BLOCK_SIZE(block);
+            while (allocated < count - 1) {
+                block->size = aligned_size | (block->size & BLOCK_FLAGS_MASK);
+                out[allocated++] = (void *)(block + 1);
+                remaining -= stride;
+                block = (struct memory_header *)((char *)(block + 1) + aligned_size);
+                memset(block, 0, sizeof(struct memory_header));
+                block->magic = HEAP_ALLOCATED;
+                block->size = remaining;
+            }
+            out[allocated++] = (void *)(block + 1);
         }
-        if (!heap_list.memory_base) {
-            heap_list.memory_base = heap_list.memory_curr = block;
+    }
+
+    while (allocated < count) {
+        struct memory_header *block = allocate_heap_block_unlocked(group, aligned_size, NULL);
+        if (block == ALLOCATION_FAILED) {
+            break;
         }
-        heap_list.memory_end = heap_list.memory_base + new_size;
-        heap_list.memory_size = new_size;
+        out[allocated++] = (void *)(block + 1);
     }
-    void* result = heap_list.memory_curr;
-    heap_list.memory_curr += block_size;
-    return result;
+    unlock_group(group);
+
+    return allocated;
 }
 
 
 /*
- * This function calculates the size class for a given size.
- * It determines which free list the block should belong to based on its size.
- * The size classes are defined in a way that each class can hold blocks of a certain size range.
+ * This function pushes a block freed by a thread of another arena onto the owner's remote-free queue.
+ * The block is claimed by switching its magic number atomically, so a double free or a concurrent
+ * free of the same pointer is still caught without the owner's lock. The link to the next queued
+ * block is kept in the payload.
+ * It returns NULL on success, or DEALLOCATION_FAILED if the block is not allocated.
  */
-size_t get_size_class(size_t size) {
-    size_t size_class = 0;
-    while(size_class < NUM_SIZE_CLASSES && size > ((sizeof(struct memory_header)*2) << (size_class+1))) {
-        size_class++;
-    }
-    if (size_class >= NUM_SIZE_CLASSES) {
-        size_class = NUM_SIZE_CLASSES - 1; // Cap at the last size class
+#ifdef OPTIHEAP_THREAD_SAFE
+static void* push_remote_free(struct heap_group *group, struct memory_header *block)
+{
+    uint32_t expected = HEAP_ALLOCATED;
+    if (!__atomic_compare_exchange_n(&block->magic, &expected, HEAP_REMOTE_FREED, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        fprintf(stderr, "Error: Magic Number -> %x, expected %x for pointer %p\n", 
+                expected, HEAP_ALLOCATED, (void *)(block + 1));
+        fprintf(stderr, "Error: Attempt to free invalid or corrupted pointer %p\n", (void *)(block + 1));
+        return DEALLOCATION_FAILED;
     }
-    return size_class;
+
+    void **link = (void **)(block + 1);
+    void *head = __atomic_load_n(&group->remote_free, __ATOMIC_RELAXED);
+    do {
+        *link = head;
+    } while (!__atomic_compare_exchange_n(&group->remote_free, &head, (void *)link, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    return NULL;
 }
 
 
 /*
- * This function inserts a block into the free list at the tail.
- * It updates the pointers accordingly to maintain the doubly linked list structure.
+ * This function frees a block of another thread's arena.
+ * While the arena has live threads the block is queued for them with push_remote_free. An arena
+ * whose threads have all exited would never drain its queue, so its blocks are freed directly
+ * under the group's lock instead. A block queued while the arena's last thread was exiting may
+ * have missed that thread's final drain, so the queue is drained here after the push if the
+ * arena turns out to have no live threads.
+ * The caller must not hold any group lock.
+ * It returns NULL on success, or DEALLOCATION_FAILED if the block is not allocated.
  */
-void insert_into_free_list(struct memory_header *block) {
-    size_t class = get_size_class(block->size);
-    block->next_free = NULL;
-    block->prev_free = heap_list.free_tail[class];
-    if (heap_list.free_tail[class]) {
-        heap_list.free_tail[class]->next_free = block;
+static void* free_remote_block(struct heap_group *group, struct memory_header *block)
+{
+    void *status;
+    if (__atomic_load_n(&group->arena->thread_count, __ATOMIC_SEQ_CST) == 0) {
+        lock_group(group);
+        status = free_heap_block_unlocked(group, block);
+        if (!status) {
+            group->remote_free_count++;
+        }
+        unlock_group(group);
+        return status;
     }
-    heap_list.free_tail[class] = block;
-    if (!heap_list.free_head[class]) {
-        heap_list.free_head[class] = block;
+
+    status = push_remote_free(group, block);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST); // Pairs with the decrement in heap_thread_exit
+    if (!status && __atomic_load_n(&group->arena->thread_count, __ATOMIC_SEQ_CST) == 0) {
+        lock_group(group);
+        drain_remote_frees(group);
+        unlock_group(group);
     }
+    return status;
 }
+#endif
 
 
 /*
- * This function removes a block from the free list.
- * It updates the pointers accordingly to maintain the doubly linked list structure.
- * If the block is the head or tail of the free list, it updates those pointers as well.
- * It sets the next_free and prev_free pointers of the block to NULL since it is no longer a part of free list.
+ * This function frees a previously allocated block of memory back to the size group owning it.
+ * It checks if the pointer is valid and if the block is currently allocated.
+ * If valid, it marks the block as free and attempts to coalesce it with adjacent free blocks.
+ * It also updates the free list accordingly. Blocks of another thread's arena are handed to
+ * the owning group's remote-free queue instead, so the owner's lock is never taken here.
  */
-void remove_from_free_list(struct memory_header *block) {
-    size_t class = get_size_class(block->size);
-    if (block->prev_free) {
-        block->prev_free->next_free = block->next_free;
-    } else {
-        heap_list.free_head[class] = block->next_free;
+void* free_heap_block(void *ptr)
+{
+    if (!ptr) return NULL;
+
+    struct memory_header *block = ((struct memory_header *)ptr) - 1;
+
+    void * status = NULL; // store the status of deallocation
+
+    struct heap_segment *segment = heap_segment_of(block);
+    if (!segment) {
+        fprintf(stderr, "Error: Attempt to free pointer %p in unallocated regions\n", ptr);
+        status = DEALLOCATION_FAILED; // Invalid pointer
+        return status;
     }
-    if (block->next_free) {
-        block->next_free->prev_free = block->prev_free;
-    } else {
-        heap_list.free_tail[class] = block->prev_free;
+
+    #ifdef OPTIHEAP_THREAD_SAFE
+    if (segment->group->arena != thread_arena) {
+        return free_remote_block(segment->group, block);
     }
-    block->next_free = block->prev_free = NULL;
+    #endif
+
+    lock_group(segment->group);
+    status = free_heap_block_unlocked(segment->group, block);
+    unlock_group(segment->group);
+    return status; // Return NULL on successful deallocation, or DEALLOCATION_FAILED on error
 }
 
 
 /*
- * This function coalesces adjacent free blocks in the heap.
- * It checks both the previous and next blocks to see if they are free.
- * If they are, it merges them into a single block and updates the free list accordingly.
- * It also ensures that the merged block is inserted back into the free list.
- * This is important for efficient memory management and to reduce fragmentation.
+ * This function moves ptrs[root] down the max-heap ptrs[0..end) until both of its children are lower.
  */
-void coalesce_free_blocks(struct memory_header *block) {
-    
-    // Check and merge with previous block if it is free
-    if (block->prev && block->prev->magic == HEAP_FREED) {
-        struct memory_header *prev = block->prev;
-        remove_from_free_list(prev);
-
-        prev->size += sizeof(struct memory_header) + block->size;
-        prev->next = block->next;
-        if (block->next) {
-            block->next->prev = prev;
-        } else {
-            heap_list.tail = prev;
+static void sift_pointer_down(void **ptrs, size_t root, size_t end)
+{
+    void *value = ptrs[root];
+    size_t child;
+    while ((child = 2 * root + 1) < end) {
+        if (child + 1 < end && (uintptr_t)ptrs[child + 1] > (uintptr_t)ptrs[child]) {
+            child++;
         }
-        block = prev;
-    }
-
-    // Check and merge with next block if it is free
-    if (block->next && block->next->magic == HEAP_FREED) {
-        struct memory_header *next = block->next;
-        remove_from_free_list(next);
-
-        block->size += sizeof(struct memory_header) + next->size;
-        block->next = next->next;
-        if (next->next) {
-            next->next->prev = block;
-        } else {
-            heap_list.tail = block;
+        if ((uintptr_t)ptrs[child] <= (uintptr_t)value) {
+            break;
         }
+        ptrs[root] = ptrs[child];
+        root = child;
     }
+    ptrs[root] = value;
+}
 
-    insert_into_free_list(block);
+
+/*
+ * This function sorts count pointers by address in place.
+ * It is a heapsort, so it needs neither recursion nor memory of its own.
+ */
+static void sort_pointers(void **ptrs, size_t count)
+{
+    for (size_t root = count / 2; root-- > 0;) {
+        sift_pointer_down(ptrs, root, count);
+    }
+    for (size_t end = count; end > 1; end--) {
+        void *largest = ptrs[0];
+        ptrs[0] = ptrs[end - 1];
+        ptrs[end - 1] = largest;
+        sift_pointer_down(ptrs, 0, end - 1);
+    }
 }
- 
+
 
 /*
- * This function allocates a block of memory from the heap.
- * It first checks the free list for a suitable block using a best-fit strategy.
- * If a suitable block is found, it splits the block if it is much larger than needed.
- * If no suitable block is found, it attempts to allocate a new block from the heap using sbrk.
- * It returns a pointer to the allocated memory, or NULL if allocation fails.
- * The function also handles alignment of the requested size to ensure proper memory alignment.
+ * This function frees count previously allocated heap blocks to their size groups.
+ * The pointers are sorted by address first, so the calling thread's blocks are freed under a
+ * single round-trip on each group lock, and a run of blocks lying back to back in memory is
+ * merged into one block that is coalesced with its neighbours only once. Blocks of other
+ * arenas go to their remote-free queues.
+ * The pointers must already be known to lie within the heap range, ptrs is reordered.
+ * It returns the number of blocks that failed validation.
  */
-void* allocate_heap_block(size_t requested_size)
+size_t free_heap_blocks(void **ptrs, size_t count)
 {
-    if (requested_size == 0) {
-        return NULL; // No allocation for zero size
+    size_t failed = 0;
+    struct heap_group *locked = NULL;
+
+    sort_pointers(ptrs, count);
+
+    for (size_t i = 0; i < count; i++) {
+        struct memory_header *block = ((struct memory_header *)ptrs[i]) - 1;
+        struct heap_segment *segment = heap_segment_of(block);
+        if (!segment) {
+            failed++;
+            continue;
+        }
+        #ifdef OPTIHEAP_THREAD_SAFE
+        if (segment->group->arena != thread_arena) {
+            if (locked) {
+                unlock_group(locked); // free_remote_block may take the owner's lock
+                locked = NULL;
+            }
+            if (free_remote_block(segment->group, block) != NULL) {
+                failed++;
+            }
+            continue;
+        }
+        #endif
+        if (segment->group != locked) {
+            if (locked) {
+                unlock_group(locked);
+            }
+            locked = segment->group;
+            lock_group(locked);
+        }
+        if (block->magic == HEAP_ALLOCATED) {
+            // Absorb the following pointers while they are the block's physical successors
+            while (i + 1 < count) {
+                struct memory_header *next = ((struct memory_header *)ptrs[i + 1]) - 1;
+                if (next != physical_successor(block) || next->magic != HEAP_ALLOCATED) {
+                    break;
+                }
+                next->magic = HEAP_FREED; // A second free of the absorbed pointer is still caught
+                block->size += sizeof(struct memory_header) + BLOCK_SIZE(next);
+                i++;
+            }
+        }
+        if (free_heap_block_unlocked(locked, block) != NULL) {
+            failed++;
+        }
+    }
+    if (locked) {
+        unlock_group(locked);
     }
 
-    void * allocation_ptr = NULL; // store the pointer to the allocated memory
+    return failed;
+}
 
-    // Align requested size to sizeof(struct memory_header)
-    size_t aligned_blocks = (requested_size + sizeof(struct memory_header) - 1) / sizeof(struct memory_header);
-    size_t aligned_size = (aligned_blocks) * sizeof(struct memory_header);
 
-    #ifdef OPTIHEAP_THREAD_SAFE
-    pthread_mutex_lock(&heap_mutex);
-    #endif
+/*
+ * This function resizes a heap block in place when it can.
+ * Shrinking splits the tail back into the free lists. Growing absorbs a free physical
+ * successor, or extends the block into the untouched tail of its segment when it is the last block there.
+ * It returns ptr if the block now holds at least requested_size bytes, NULL if it has to be moved,
+ * or ALLOCATION_FAILED if ptr is not an allocated heap block.
+ */
+void* reallocate_heap_block(void *ptr, size_t requested_size)
+{
+    struct memory_header *block = ((struct memory_header *)ptr) - 1;
+    size_t aligned_size = HEAP_ALIGN(requested_size);
 
-    // The use of extra sizeof(struct memory_header) helps in ensuring that
-    // the first block that we encounter in the free list is large enough
-    size_t class = get_size_class(aligned_size) + 1;
+    struct heap_segment *segment = heap_segment_of(block);
+    if (!segment) {
+        fprintf(stderr, "Error: Attempt to reallocate invalid or corrupted pointer %p\n", ptr);
+        return ALLOCATION_FAILED;
+    }
+    struct heap_group *group = segment->group;
+    void *result = NULL;
 
-    struct memory_header *first_fit = NULL;
+    lock_group(group);
 
-    // First-fit search: look for the first block in any suitable class
-    for (size_t c = class; c < NUM_SIZE_CLASSES; ++c) {
-        if (!heap_list.free_head[c]) continue;
-        first_fit = heap_list.free_head[c];
-        break;
+    if (block->magic != HEAP_ALLOCATED) {
+        fprintf(stderr, "Error: Attempt to reallocate invalid or corrupted pointer %p\n", ptr);
+        result = ALLOCATION_FAILED;
+        goto END;
     }
 
-    if (first_fit) {
-        size_t excess = first_fit->size - aligned_size;
-        
-        remove_from_free_list(first_fit); // Remove from free list
-        first_fit->magic = HEAP_ALLOCATED; // Mark as allocated
-        
-        // if there's excess, we split the block to use the excess space later
-        if (excess > 2*sizeof(struct memory_header)) {
+    if (aligned_size <= BLOCK_SIZE(block)) {
+        split_heap_block(group, block, aligned_size);
+        result = ptr;
+        goto END;
+    }
 
-            // Modify the best_fit block
-            first_fit->size = aligned_size; // Set the size of the allocated block
-            
-            // Create a new free block for the excess space
-            struct memory_header *new_free = (struct memory_header *)((char *)(first_fit) + sizeof(struct memory_header) + aligned_size);
-            memset(new_free, 0, sizeof(struct memory_header)); // Initialize the new block
-            new_free->size = excess - sizeof(struct memory_header);
-            new_free->magic = HEAP_FREED;
-            new_free->next = first_fit->next;
-            new_free->prev = first_fit;
-            
-            insert_into_free_list(new_free);
+    struct memory_header *next = physical_successor(block);
+    if (next->magic == HEAP_FREED &&
+        BLOCK_SIZE(block) + sizeof(struct memory_header) + BLOCK_SIZE(next) >= aligned_size) {
+        // Absorb the free successor, its own successor is no longer preceded by a free block
+        remove_from_free_list(group, next);
+        block->size += sizeof(struct memory_header) + BLOCK_SIZE(next);
+        struct memory_header *after = next_physical_block(block);
+        if (after) {
+            after->size &= ~BLOCK_PREV_FREE;
+        }
+        split_heap_block(group, block, aligned_size);
+        result = ptr;
+    } else if (next->magic == HEAP_EPILOGUE) {
+        // The block borders the untouched tail of its segment, which is contiguous with it
+        size_t growth = aligned_size - BLOCK_SIZE(block);
+        if (extend_segment(segment, growth)) {
+            block->size += growth;
+            result = ptr;
+        }
+    }
+
+    END:
+    unlock_group(group);
+    return result;
+}
+
+
+/*
+ * This function returns as much free heap memory to the OS as possible: in every size group the
+ * interior pages of every free block are released with madvise and the tail of every segment
+ * is decommitted down to pad bytes.
+ * It returns 1 if any memory was released, otherwise returns 0.
+ */
+int heap_trim(size_t pad)
+{
+    int released = 0;
 
-            if (first_fit->next) {
-                first_fit->next->prev = new_free;
-            } else {
-                heap_list.tail = new_free;
+    for (size_t i = 0; i < OPTIHEAP_HEAP_MAX_ARENAS; i++) {
+        for (size_t g = 0; g < HEAP_SIZE_GROUPS; g++) {
+            struct heap_group *group = &heap_arenas[i].groups[g];
+            lock_group(group);
+            drain_remote_frees(group);
+            for (size_t fl = 0; fl < FL_INDEX_COUNT; fl++) {
+                for (size_t sl = 0; sl < SL_INDEX_COUNT; sl++) {
+                    for (struct memory_header *block = group->free_head[fl][sl]; block; block = free_links(block)->next_free) {
+                        released |= release_free_pages(block, (char *)block, (char *)(block + 1) + BLOCK_SIZE(block), 0);
+                    }
+                }
+            }
+            for (struct heap_segment *segment = group->segments; segment; segment = segment->group_next) {
+                released |= trim_segment_tail(segment, pad);
             }
-            first_fit->next = new_free;
+            unlock_group(group);
         }
+    }
 
-        allocation_ptr = (void *)(first_fit + 1);
-        goto END;
+    return released;
+}
+
+
+/*
+ * This function makes sure size group group_index of the calling thread's arena can carve bytes
+ * of blocks, headers included, from the untouched tail of one segment without a page fault.
+ * The tail is committed and faulted in, a new segment is reserved if no segment has room for it.
+ * The reserved memory stays in the tail until it is used or the heap is trimmed; it does not
+ * count towards the trim threshold, which only covers memory that was handed out before.
+ * It returns 0 on success, or -1 if the memory could not be reserved.
+ */
+int heap_reserve(size_t group_index, size_t bytes)
+{
+    if (group_index >= HEAP_SIZE_GROUPS || bytes > SIZE_MAX / 2) {
+        fprintf(stderr, "Error: Unable to reserve %zu bytes of heap\n", bytes);
+        return -1;
     }
+    int result = -1;
+    struct heap_group *group = &current_arena()->groups[group_index];
+    lock_group(group);
 
-    // No suitable free block, allocate new
-    struct memory_header *new_block = (struct memory_header *)try_heap_allocation(aligned_size + sizeof(struct memory_header));
-    
-    if(new_block == ALLOCATION_FAILED) {
-        fprintf(stderr, "Error: Unable to allocate %zu bytes from heap\n", aligned_size + sizeof(struct memory_header));
-        allocation_ptr = ALLOCATION_FAILED; // Allocation failed
+    struct heap_segment *segment = segment_with_room(group, bytes);
+    if (!segment || !commit_segment(segment, segment->curr + bytes + sizeof(struct memory_header))) {
         goto END;
     }
-    
-    memset(new_block, 0, sizeof(struct memory_header)); // Initialize the new block
-    new_block->magic = HEAP_ALLOCATED;
-    new_block->size = aligned_size; // Set the size of the allocated block
-    new_block->prev = heap_list.tail;
+    // Under the lock, so that a concurrent trim cannot decommit the range being faulted in
+    prefault_pages(segment->curr, bytes + sizeof(struct memory_header));
+    result = 0;
 
+    END:
+    unlock_group(group);
+    return result;
+}
 
 
-    if (heap_list.tail) {
-        heap_list.tail->next = new_block;
-    }
-    heap_list.tail = new_block;
-    if (!heap_list.head) {
-        heap_list.head = new_block;
+/*
+ * This function sets how many bytes of dirty memory may sit in the free tail of a heap segment
+ * before the tail is decommitted.
+ */
+void heap_set_trim_threshold(size_t threshold)
+{
+    heap_trim_threshold = threshold;
+}
+
+
+size_t heap_get_trim_threshold(void)
+{
+    return heap_trim_threshold;
+}
+
+
+/*
+ * This function sets the size from which a coalesced free block has the pages of the block
+ * freed into it released with madvise, SIZE_MAX disables the release.
+ */
+void heap_set_release_threshold(size_t threshold)
+{
+    heap_release_threshold = threshold;
+}
+
+
+size_t heap_get_release_threshold(void)
+{
+    return heap_release_threshold;
+}
+
+
+/*
+ * This function sets the number of arenas threads are spread over.
+ * Threads keep the arena they were assigned, only threads that use the heap for the first
+ * time afterwards see the new count.
+ * It returns 0 on success, or -1 if the count is 0, above OPTIHEAP_HEAP_MAX_ARENAS, or
+ * thread safety is disabled.
+ */
+int heap_set_arena_count([[maybe_unused]]size_t count)
+{
+    #ifdef OPTIHEAP_THREAD_SAFE
+    if (count == 0 || count > OPTIHEAP_HEAP_MAX_ARENAS) {
+        fprintf(stderr, "Error: Arena count %zu is not between 1 and %d\n", count, OPTIHEAP_HEAP_MAX_ARENAS);
+        return -1;
     }
+    heap_arena_count = count;
+    return 0;
+    #else
+    fprintf(stderr, "Error: Multiple arenas are only available with -DOPTIHEAP_THREAD_SAFE.\n");
+    return -1;
+    #endif
+}
 
-    allocation_ptr = (void *)(new_block + 1); // Return pointer to the data area
 
-    END:
+size_t heap_get_arena_count(void)
+{
     #ifdef OPTIHEAP_THREAD_SAFE
-    pthread_mutex_unlock(&heap_mutex);
+    return heap_arena_count;
+    #else
+    return 1;
     #endif
-    return allocation_ptr;
 }
 
 
 /*
- * This function frees a previously allocated block of memory.
- * It checks if the pointer is valid and if the block is currently allocated.
- * If valid, it marks the block as free and attempts to coalesce it with adjacent free blocks.
- * It also updates the free list accordingly.
+ * This function fills stats with a snapshot of an arena, summed over its size groups,
+ * each of which is read under its lock.
+ * It returns 0 on success, or -1 if index does not name an arena.
  */
-void* free_heap_block(void *ptr)
+int heap_get_arena_stats(size_t index, struct optiheap_arena_stats *stats)
 {
-    if (!ptr) return NULL;
+    if (index >= OPTIHEAP_HEAP_MAX_ARENAS) {
+        return -1;
+    }
 
-    struct memory_header *block = ((struct memory_header *)ptr) - 1;
+    struct heap_arena *arena = &heap_arenas[index];
+    memset(stats, 0, sizeof(*stats));
+    for (size_t g = 0; g < HEAP_SIZE_GROUPS; g++) {
+        struct heap_group *group = &arena->groups[g];
+        lock_group(group);
+        stats->segments += group->segment_count;
+        stats->committed_bytes += group->committed_size;
+        for (struct heap_segment *segment = group->segments; segment; segment = segment->group_next) {
+            stats->used_bytes += (size_t)(segment->curr - (char *)segment) - HEAP_SEGMENT_HEADER_SIZE;
+        }
+        stats->free_bytes += group->free_size;
+        stats->used_bytes -= group->free_size;
+        stats->contended_locks += group->contention_count;
+        stats->remote_frees += group->remote_free_count;
+        unlock_group(group);
+    }
+    stats->threads = __atomic_load_n(&arena->thread_count, __ATOMIC_RELAXED);
+    return 0;
+}
 
-    void * status = NULL; // store the status of deallocation
 
-    if (!within_heap_range(block)) {
-        fprintf(stderr, "Error: Attempt to free pointer %p in unallocated regions\n", ptr);
-        status = DEALLOCATION_FAILED; // Invalid pointer
-        return status;
+/*
+ * This function returns the bytes committed in the segments of every size group that are advised
+ * to use transparent huge pages, each group is read under its lock.
+ */
+size_t heap_huge_page_bytes(void)
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < OPTIHEAP_HEAP_MAX_ARENAS; i++) {
+        for (size_t g = 0; g < HEAP_SIZE_GROUPS; g++) {
+            struct heap_group *group = &heap_arenas[i].groups[g];
+            lock_group(group);
+            for (struct heap_segment *segment = group->segments; segment; segment = segment->group_next) {
+                if (segment->huge) {
+                    bytes += (size_t)(segment->commit_end - (char *)segment);
+                }
+            }
+            unlock_group(group);
+        }
     }
+    return bytes;
+}
 
-    #ifdef OPTIHEAP_THREAD_SAFE
-    pthread_mutex_lock(&heap_mutex);
-    #endif
 
-    if (block->magic != HEAP_ALLOCATED) {
-        fprintf(stderr, "Error: Magic Number -> %x, expected %x for pointer %p\n", 
-                block->magic, HEAP_ALLOCATED, ptr);
-        fprintf(stderr, "Error: Attempt to free invalid or corrupted pointer %p\n", ptr);
-        status = DEALLOCATION_FAILED;
-        goto END;
+#ifdef OPTIHEAP_THREAD_SAFE
+/*
+ * This function takes the lock of every size group, in arena and group order, and then the segment list lock.
+ */
+void heap_lock_all(void)
+{
+    for (size_t i = 0; i < OPTIHEAP_HEAP_MAX_ARENAS; i++) {
+        for (size_t g = 0; g < HEAP_SIZE_GROUPS; g++) {
+            adaptive_lock_acquire(&heap_arenas[i].groups[g].mutex);
+        }
     }
+    adaptive_lock_acquire(&heap_segment_mutex);
+}
 
-    block->magic = HEAP_FREED; // This helps to identify the block as free
-    
-    // Coalesce with adjacent free blocks and insert into free list
-    coalesce_free_blocks(block);
-    status = NULL;
 
-    END:
-    #ifdef OPTIHEAP_THREAD_SAFE
-    pthread_mutex_unlock(&heap_mutex);
-    #endif
-    return status; // Return NULL on successful deallocation, or DEALLOCATION_FAILED on error
+void heap_unlock_all(void)
+{
+    adaptive_lock_release(&heap_segment_mutex);
+    for (size_t i = OPTIHEAP_HEAP_MAX_ARENAS; i-- > 0;) {
+        for (size_t g = HEAP_SIZE_GROUPS; g-- > 0;) {
+            adaptive_lock_release(&heap_arenas[i].groups[g].mutex);
+        }
+    }
 }
+#endif
 
 
 void debug_print_heap([[maybe_unused]]int debug_id)
 {
     #ifdef OPTIHEAP_DEBUGGER
     #ifdef OPTIHEAP_THREAD_SAFE
-    pthread_mutex_lock(&heap_mutex);
+    heap_lock_all();
     #endif
-    struct memory_header *curr = heap_list.head;
+    struct memory_header *curr = heap_first_block();
     printf("================================================================= START DEBUG_ID : %d\n", debug_id);
     printf("Heap Memory State:\n");
-    printf("Heap Size: %zu bytes\n", heap_list.memory_size);
-    printf("Heap Start: %p - Heap End: %p\n", heap_list.memory_base, heap_list.memory_end);
+    for (size_t i = 0; i < OPTIHEAP_HEAP_MAX_ARENAS; i++) {
+        for (size_t g = 0; g < HEAP_SIZE_GROUPS; g++) {
+            struct heap_group *group = &heap_arenas[i].groups[g];
+            if (!group->segments) {
+                continue;
+            }
+            printf("Arena %zu group %zu: \t threads=%zu, segments=%zu, committed=%zu, free=%zu, contended=%zu, remote frees=%zu\n",
+                i, g, heap_arenas[i].thread_count, group->segment_count, group->committed_size, group->free_size,
+                group->contention_count, group->remote_free_count);
+            for (struct heap_segment *segment = group->segments; segment; segment = segment->group_next) {
+                printf("Segment at %p: \t used=%zu, committed=%zu, reserved=%zu\n",
+                    (void*)segment,
+                    (size_t)(segment->curr - (char *)segment),
+                    (size_t)(segment->commit_end - (char *)segment),
+                    (size_t)(segment->end - (char *)segment));
+            }
+        }
+    }
     while (curr) {
         printf("Block at %p: \t State=%s \tdata_size=%zu, total_size=%zu\n",
             (void*)curr,
             curr->magic == HEAP_ALLOCATED ? "ALLOCATED" :
-            (curr->magic == HEAP_FREED ? "  FREE   " : "CORRUPTED"),
-            curr->size,
-            curr->size + sizeof(struct memory_header));
-        curr = curr->next;
+            (curr->magic == HEAP_FREED ? "  FREE   " :
+            (curr->magic == HEAP_CACHED ? " CACHED  " :
+            (curr->magic == HEAP_REMOTE_FREED ? " REMOTE  " : "CORRUPTED"))),
+            BLOCK_SIZE(curr),
+            BLOCK_SIZE(curr) + sizeof(struct memory_header));
+        curr = heap_next_block(curr);
     }
     printf("================================================================= END DEBUG_ID : %d\n", debug_id);
     #ifdef OPTIHEAP_THREAD_SAFE
-    pthread_mutex_unlock(&heap_mutex);
+    heap_unlock_all();
     #endif
     #else
     printf("Warning: OptiHeap Debugger is disabled. Enable it by compiling with -DOPTIHEAP_DEBUGGER flag to see heap state.\n");
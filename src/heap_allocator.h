@@ -5,36 +5,184 @@
 #define DEALLOCATION_FAILED ((void*)-2)
 
 #include <stddef.h>
+#include <stdint.h>
 #include "memory_structs.h"
+#include "../include/optiheap_allocator.h"
 
-#define NUM_SIZE_CLASSES 11 // Number of free lists in the segregated free list system
+#ifdef OPTIHEAP_THREAD_SAFE
+#include "adaptive_lock.h"
+#endif
 
-// Class sizes-> class_i = 2^(i+1) * sizeof(struct memory_header) bytes
+/*
+ * Free blocks are indexed with a two-level segregated fit (TLSF) scheme.
+ * The first level splits sizes by power of two, the second level splits every
+ * power-of-two range into SL_INDEX_COUNT linear lists. Sizes below SMALL_BLOCK_SIZE
+ * all live in first level 0, split linearly. One bitmap per level records the
+ * non-empty lists, so classifying a size and finding a fitting list are both O(1).
+ */
+#define SL_INDEX_COUNT_LOG2 4
+#define SL_INDEX_COUNT (1 << SL_INDEX_COUNT_LOG2)
+#define FL_ALIGN_LOG2 4
+#define FL_INDEX_SHIFT (SL_INDEX_COUNT_LOG2 + FL_ALIGN_LOG2)
+#define FL_INDEX_MAX 47 // Largest free block tracked precisely is 2^48 - 1 bytes
+#define FL_INDEX_COUNT (FL_INDEX_MAX - FL_INDEX_SHIFT + 2)
+#define SMALL_BLOCK_SIZE ((size_t)1 << FL_INDEX_SHIFT)
 
-struct heap_memory_list {
-    struct memory_header *head; // First block in all-blocks list
-    struct memory_header *tail; // Last block in all-blocks list
-    struct memory_header *free_head[NUM_SIZE_CLASSES]; // First blocks in free lists
-    struct memory_header *free_tail[NUM_SIZE_CLASSES]; // Last blocks in free lists
+// Free-list links of a free heap block, stored in its payload
+struct free_block_links {
+    struct memory_header *next_free; // Next in free list
+    struct memory_header *prev_free; // Prev in free list
+};
 
-    // Memory region management
-    char *memory_base;
-    char *memory_curr;
-    char *memory_end;
-    size_t memory_size;
-}; 
+#define HEAP_ALIGNMENT 16
+// A free block must be able to hold its links and its footer
+#define HEAP_MIN_PAYLOAD ((sizeof(struct free_block_links) + sizeof(size_t) + HEAP_ALIGNMENT - 1) & ~(size_t)(HEAP_ALIGNMENT - 1))
+
+// Rounds a requested size up to the heap's allocation granularity
+#define HEAP_ALIGN(size) ((size) <= HEAP_MIN_PAYLOAD ? HEAP_MIN_PAYLOAD : (((size) + HEAP_ALIGNMENT - 1) & ~(size_t)(HEAP_ALIGNMENT - 1)))
+
+/*
+ * The heap lives in segments: large ranges of address space reserved with PROT_NONE and
+ * committed with mprotect in OPTIHEAP_HEAP_COMMIT_STEP steps as blocks are carved from them.
+ * A new segment is reserved wherever the kernel finds room once the existing ones are full,
+ * so the heap does not depend on a contiguous program break. Segments are never unmapped.
+ */
+#ifndef OPTIHEAP_HEAP_SEGMENT_SIZE
+#define OPTIHEAP_HEAP_SEGMENT_SIZE ((size_t)64 * 1024 * 1024)
+#endif
+
+#ifndef OPTIHEAP_HEAP_COMMIT_STEP
+#define OPTIHEAP_HEAP_COMMIT_STEP ((size_t)256 * 1024)
+#endif
+
+// Dirty bytes the free tail of a heap segment may hold before it is decommitted
+#ifndef OPTIHEAP_HEAP_TRIM_THRESHOLD
+#define OPTIHEAP_HEAP_TRIM_THRESHOLD (1024 * 1024)
+#endif
 
-extern struct heap_memory_list heap_list;
+// Bytes kept committed after the last block of a segment when its tail is trimmed automatically
+#define OPTIHEAP_HEAP_TOP_PAD (128 * 1024)
 
+// Coalesced free blocks at least this large release the pages of blocks freed into them
+#ifndef OPTIHEAP_HEAP_RELEASE_THRESHOLD
+#define OPTIHEAP_HEAP_RELEASE_THRESHOLD (1024 * 1024)
+#endif
+
+// Smallest run of whole pages worth a madvise call when a block is freed
+#define OPTIHEAP_HEAP_RELEASE_MIN (64 * 1024)
+
+// Upper bound on the number of heap arenas
+#ifndef OPTIHEAP_HEAP_MAX_ARENAS
+#define OPTIHEAP_HEAP_MAX_ARENAS 64
+#endif
+
+struct heap_group;
+
+/*
+ * Bookkeeping at the start of every heap segment.
+ * Blocks are laid out back to back from the first aligned address after it up to curr,
+ * where a header with magic HEAP_EPILOGUE marks the end of the segment's blocks.
+ */
+struct heap_segment {
+    struct heap_segment *next; // Next segment of any arena, in order of creation
+    struct heap_segment *group_next; // Next segment of the same size group
+    struct heap_group *group; // Size group owning every block of the segment
+    char *curr; // Start of the untouched tail of the segment, free blocks ending here are absorbed into it
+    char *pristine; // Memory from here up to commit_end was never handed out and is still zero-filled
+    char *commit_end; // End of the read/write part of the segment
+    char *end; // End of the reserved range
+    size_t huge; // Set if the segment is 2 MiB aligned and advised to use transparent huge pages
+};
+
+// Offset of the first block of a segment
+#define HEAP_SEGMENT_HEADER_SIZE ((sizeof(struct heap_segment) + HEAP_ALIGNMENT - 1) & ~(size_t)(HEAP_ALIGNMENT - 1))
+
+/*
+ * Block sizes are split into HEAP_SIZE_GROUPS groups: up to HEAP_SIZE_GROUP_BASE bytes,
+ * then HEAP_SIZE_GROUP_SHIFT more bits per group, and everything larger in the last one.
+ * Every group of an arena keeps its own segments, so blocks of different groups are never
+ * neighbours and coalescing never leaves the group whose lock is held.
+ * Single-threaded builds have no locks to split and keep all sizes in one group.
+ */
 #ifdef OPTIHEAP_THREAD_SAFE
-#include <pthread.h>
-extern pthread_mutex_t heap_mutex; // Mutex for thread safety
+#define HEAP_SIZE_GROUPS 4
+#else
+#define HEAP_SIZE_GROUPS 1
 #endif
+#define HEAP_SIZE_GROUP_BASE ((size_t)1024)
+#define HEAP_SIZE_GROUP_SHIFT 3
+
+/*
+ * A size group is an independent heap with its own free lists, segments and lock.
+ * A thread freeing a block of another arena does not take the group's lock: it pushes the
+ * block onto the group's remote-free queue, a lock-free stack linked through the payloads,
+ * which the arena's own threads drain in one batch on their next allocation of that group
+ * or when they exit. Blocks of an arena without live threads are freed under the lock instead.
+ */
+struct heap_group {
+    uint64_t fl_bitmap; // Bit i set if any list of first level i is non-empty
+    uint32_t sl_bitmap[FL_INDEX_COUNT]; // Bit j of entry i set if free_head[i][j] is non-empty
+    struct memory_header *free_head[FL_INDEX_COUNT][SL_INDEX_COUNT]; // First blocks in free lists
+
+    // Memory region management
+    struct heap_segment *segments; // Oldest segment of the group, segments are never removed
+    struct heap_segment *last_segment;
+    struct heap_arena *arena; // Arena the group belongs to
+
+    // Statistics
+    size_t segment_count;
+    size_t committed_size; // Bytes currently committed across the group's segments
+    size_t free_size; // Bytes of payload held in the free lists
+    size_t contention_count; // Lock acquisitions that found the group locked
+    size_t remote_free_count; // Blocks freed by threads of other arenas
+
+    #ifdef OPTIHEAP_THREAD_SAFE
+    struct adaptive_lock mutex;
+    void *remote_free; // Payloads of blocks freed by other arenas' threads, pushed with a compare-and-swap
+    #endif
+};
+
+/*
+ * An arena is the set of size groups a thread allocates from.
+ * Threads are spread over the arenas round-robin the first time they use the heap,
+ * while a block is always freed back to the group owning its segment. Threads of one arena
+ * allocating sizes of different groups take different locks.
+ */
+struct heap_arena {
+    struct heap_group groups[HEAP_SIZE_GROUPS];
+    size_t thread_count; // Live threads assigned to the arena
+};
+
+extern struct heap_arena heap_arenas[OPTIHEAP_HEAP_MAX_ARENAS];
+extern struct heap_segment *heap_segments; // Every segment of every arena, in order of creation, for walking the heap
 
 void heap_allocator_init(void);
 void* allocate_heap_block(size_t size);
+void* allocate_heap_block_zeroed(size_t size);
+void* allocate_heap_block_aligned(size_t alignment, size_t size);
 void* free_heap_block(void* ptr);
+size_t allocate_heap_blocks(size_t aligned_size, void **out, size_t count);
+size_t free_heap_blocks(void **ptrs, size_t count);
+void* reallocate_heap_block(void *ptr, size_t requested_size);
 int within_heap_range(void *ptr);
+int heap_block_is_local(struct memory_header *block);
+struct memory_header* heap_first_block(void);
+struct memory_header* heap_next_block(struct memory_header *block);
+#ifdef OPTIHEAP_THREAD_SAFE
+void heap_lock_all(void);
+void heap_unlock_all(void);
+#endif
+int heap_trim(size_t pad);
+size_t heap_size_group(size_t aligned_size);
+int heap_reserve(size_t group_index, size_t bytes);
+void heap_set_trim_threshold(size_t threshold);
+size_t heap_get_trim_threshold(void);
+void heap_set_release_threshold(size_t threshold);
+size_t heap_get_release_threshold(void);
+int heap_set_arena_count(size_t count);
+size_t heap_get_arena_count(void);
+int heap_get_arena_stats(size_t index, struct optiheap_arena_stats *stats);
+size_t heap_huge_page_bytes(void);
 void debug_print_heap(int debug_id);
 
 #endif // HEAP_ALLOCATOR_H
\ No newline at end of file
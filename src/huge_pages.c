@@ -0,0 +1,136 @@
+#define _GNU_SOURCE // MAP_HUGETLB and MADV_HUGEPAGE are Linux extensions
+#include "huge_pages.h"
+#include "page_map.h"
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * This file holds what the heap and mmap tiers share to place memory on huge pages.
+ * Transparent huge pages only back 2 MiB ranges that are aligned and entirely inside one
+ * mapping, so the memory meant for them is mapped 2 MiB aligned and advised with MADV_HUGEPAGE.
+ * Explicit huge pages come from the hugetlbfs pool reserved by the administrator; the pool
+ * is often empty, so mapping from it falls back to transparent huge pages.
+ */
+
+int huge_page_mode = OPTIHEAP_HUGE_PAGES;
+
+
+/*
+ * This function maps length bytes, a multiple of HUGE_PAGE_SIZE, for huge pages.
+ * If hugetlb is not NULL and the mode is OPTIHEAP_HUGE_PAGES_EXPLICIT the mapping is made
+ * with MAP_HUGETLB first, and *hugetlb tells whether it was. Otherwise, or when no explicit
+ * huge pages are left, the mapping is aligned to HUGE_PAGE_SIZE and advised with MADV_HUGEPAGE.
+ * Callers that reserve with MAP_NORESERVE must pass a NULL hugetlb, since touching a hugetlbfs
+ * page that could not be reserved kills the process.
+ * It returns the mapping, or MAP_FAILED.
+ */
+void* huge_page_map(size_t length, int prot, int flags, int *hugetlb)
+{
+    if (hugetlb) {
+        *hugetlb = 0;
+        if (huge_page_mode == OPTIHEAP_HUGE_PAGES_EXPLICIT) {
+            void *mapping = mmap(NULL, length, prot, flags | MAP_HUGETLB, -1, 0);
+            if (mapping != MAP_FAILED) {
+                *hugetlb = 1;
+                return mapping;
+            }
+        }
+    }
+
+    // Over-map by one huge page, then cut the mapping down to the aligned range
+    char *mapping = mmap(NULL, length + HUGE_PAGE_SIZE, prot, flags, -1, 0);
+    if (mapping == MAP_FAILED) {
+        return MAP_FAILED;
+    }
+    char *start = (char *)HUGE_PAGE_ALIGN((uintptr_t)mapping);
+    if (start > mapping) {
+        munmap(mapping, (size_t)(start - mapping));
+    }
+    munmap(start + length, (size_t)(mapping + HUGE_PAGE_SIZE - start));
+    madvise(start, length, MADV_HUGEPAGE); // Fails harmlessly on kernels without transparent huge pages
+    return start;
+}
+
+
+/*
+ * This function grows a mapping made by huge_page_map from old_length to new_length bytes,
+ * a multiple of HUGE_PAGE_SIZE. It is grown in place when the range after it is free,
+ * otherwise it is moved onto a fresh aligned range, so the kernel can keep moving whole
+ * huge pages instead of splitting them at an unaligned address.
+ * It returns the mapping, or MAP_FAILED with the old mapping left untouched.
+ */
+void* huge_page_remap(void *mapping, size_t old_length, size_t new_length)
+{
+    void *grown = mremap(mapping, old_length, new_length, 0);
+    if (grown != MAP_FAILED) {
+        return grown;
+    }
+    void *target = huge_page_map(new_length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, NULL);
+    if (target == MAP_FAILED) {
+        return MAP_FAILED;
+    }
+    void *moved = mremap(mapping, old_length, new_length, MREMAP_MAYMOVE | MREMAP_FIXED, target);
+    if (moved == MAP_FAILED) {
+        munmap(target, new_length);
+    }
+    return moved;
+}
+
+
+/*
+ * This function reads from /proc/self/smaps how many bytes the kernel backs with transparent
+ * huge pages in heap segments and in mmap blocks. A mapping is attributed to the tier owning
+ * its first page in the page map, which also holds when the kernel merged adjacent mappings
+ * of the same tier. The file is read with plain system calls, so nothing is allocated while
+ * measuring. Both counts are 0 when the file cannot be read.
+ */
+void huge_page_measure(size_t *heap_bytes, size_t *mmap_bytes)
+{
+    *heap_bytes = 0;
+    *mmap_bytes = 0;
+    int fd = open("/proc/self/smaps", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+
+    char buffer[4096];
+    size_t filled = 0;
+    uintptr_t kind = 0; // Tier of the mapping whose fields are being read
+    for (;;) {
+        ssize_t got = read(fd, buffer + filled, sizeof(buffer) - 1 - filled);
+        if (got <= 0) {
+            break;
+        }
+        filled += (size_t)got;
+        buffer[filled] = '\0';
+
+        char *line = buffer;
+        char *newline;
+        while ((newline = strchr(line, '\n'))) {
+            *newline = '\0';
+            if ((*line >= '0' && *line <= '9') || (*line >= 'a' && *line <= 'f')) {
+                // A mapping starts with its address range, field names start with a capital
+                kind = PAGE_MAP_KIND(page_map_get((void *)(uintptr_t)strtoull(line, NULL, 16)));
+            } else if (strncmp(line, "AnonHugePages:", 14) == 0) {
+                size_t bytes = (size_t)strtoull(line + 14, NULL, 10) * 1024;
+                if (kind == PAGE_MAP_HEAP) {
+                    *heap_bytes += bytes;
+                } else if (kind == PAGE_MAP_MMAP) {
+                    *mmap_bytes += bytes;
+                }
+            }
+            line = newline + 1;
+        }
+        filled -= (size_t)(line - buffer);
+        memmove(buffer, line, filled);
+        if (filled == sizeof(buffer) - 1) {
+            filled = 0; // No field is this long, skip the line
+        }
+    }
+    close(fd);
+}
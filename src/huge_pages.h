@@ -0,0 +1,22 @@
+#ifndef HUGE_PAGES_H
+#define HUGE_PAGES_H
+
+#include <stddef.h>
+#include "../include/optiheap_allocator.h"
+
+// Size of the huge pages heap segments and large mappings are aligned to (the PMD size with 4 KiB base pages)
+#define HUGE_PAGE_SIZE ((size_t)2 * 1024 * 1024)
+#define HUGE_PAGE_ALIGN(size) (((size) + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1))
+
+// Huge page mode the allocator starts in, one of enum optiheap_huge_pages
+#ifndef OPTIHEAP_HUGE_PAGES
+#define OPTIHEAP_HUGE_PAGES OPTIHEAP_HUGE_PAGES_OFF
+#endif
+
+extern int huge_page_mode; // Current enum optiheap_huge_pages value, read without a lock
+
+void* huge_page_map(size_t length, int prot, int flags, int *hugetlb);
+void* huge_page_remap(void *mapping, size_t old_length, size_t new_length);
+void huge_page_measure(size_t *heap_bytes, size_t *mmap_bytes);
+
+#endif // HUGE_PAGES_H
@@ -6,19 +6,40 @@
 
 #define HEAP_FREED 0xDEADBEEF
 #define HEAP_ALLOCATED 0xCAFEBABE
+#define HEAP_CACHED 0xC0FFEE00 // allocated from the heap's point of view, but parked in a thread cache
+#define HEAP_REMOTE_FREED 0xF4EEF4EE // freed by a thread of another arena, waiting in the owner's remote-free queue
+#define HEAP_EPILOGUE 0xE0F0E0F0 // closes the blocks of a heap segment, its size field points to the segment
 #define MMAP_FREED 0xFEEDFACE // this is not really used, but kept for consistency
 #define MMAP_ALLOCATED 0xBEEFCAFE
 
+// Biased reference counting keeps per-thread owners, so it builds on both of these features
+#if defined(OPTIHEAP_BIASED_REFERENCE_COUNTING) && !(defined(OPTIHEAP_REFERENCE_COUNTING) && defined(OPTIHEAP_THREAD_SAFE))
+#error "OPTIHEAP_BIASED_REFERENCE_COUNTING requires OPTIHEAP_REFERENCE_COUNTING and OPTIHEAP_THREAD_SAFE"
+#endif
+
+// Status bits kept in the low bits of memory_header.size, block sizes are multiples of 16
+#define BLOCK_PREV_FREE 0x1 // The physical predecessor is a free heap block with a footer
+#define BLOCK_FLAGS_MASK ((size_t)0xF)
+#define BLOCK_SIZE(block) ((block)->size & ~BLOCK_FLAGS_MASK)
+
+/*
+ * Compact block header shared by heap and mmap blocks, it keeps payloads 16-byte aligned.
+ * Heap blocks use boundary tags: physical neighbours are found by size arithmetic,
+ * free blocks keep their free-list links in the payload and a copy of their size
+ * in a footer at the end of the payload.
+ */
 struct memory_header {
-    size_t size; // Size of the block
+    size_t size; // Size of the block's payload, low bits hold BLOCK_* status flags
     uint32_t magic; // Magic number for allocation status and validation
-    struct memory_header *next; // Next in all-blocks list
-    struct memory_header *prev; // Prev in all-blocks list
-    struct memory_header *next_free; // Next in free list
-    struct memory_header *prev_free; // Prev in free list
+    uint32_t reserved; // Keeps the payload 16-byte aligned, cached mmap regions keep their release time here
     #ifdef OPTIHEAP_REFERENCE_COUNTING
-    size_t ref_count; // Reference count for the block
+    size_t ref_count; // Reference count for the block, the shared count and its state bits in biased mode
     void (*destructor)(void *); // Destructor function for the block
+    #ifdef OPTIHEAP_BIASED_REFERENCE_COUNTING
+    uint32_t ref_owner; // Owner slot of the thread the block is biased towards, 0 if it is not biased
+    uint32_t ref_biased; // References counted by the owner without atomic operations
+    struct memory_header *ref_next; // Next block in the owner's merge queue
+    #endif
     #endif
 };
 
@@ -1,16 +1,32 @@
+#define _GNU_SOURCE // MAP_ANONYMOUS and mremap are not part of strict C99
 #include "memory_structs.h"
 #include "mmap_allocator.h"
+#include "page_map.h"
+#include "huge_pages.h"
 
 #include <sys/mman.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
-#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
 
 struct mmap_memory_list mmap_list;
 
+/*
+ * The threshold starts at MAX_HEAP_ALLOC_SIZE and follows the workload like glibc's does:
+ * an mmap block that is freed shortly after it was allocated shows that blocks of its size
+ * churn, so the threshold is raised to its size and later requests of that size are served
+ * by the heap, whose freed blocks are reused without syscalls or page faults.
+ * Setting the threshold explicitly pins it and stops the adaptation.
+ */
+size_t mmap_threshold = MAX_HEAP_ALLOC_SIZE;
+static size_t mmap_threshold_max = OPTIHEAP_MMAP_THRESHOLD_MAX;
+static int mmap_threshold_pinned = 0;
+
 #ifdef OPTIHEAP_THREAD_SAFE
-pthread_mutex_t mmap_mutex = PTHREAD_MUTEX_INITIALIZER;
+struct adaptive_lock mmap_mutex = ADAPTIVE_LOCK_INITIALIZER;
 #endif
 
 /*
@@ -21,22 +37,52 @@ pthread_mutex_t mmap_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 void mmap_allocator_init() {
     #ifdef OPTIHEAP_THREAD_SAFE
-    pthread_mutex_lock(&mmap_mutex);
+    adaptive_lock_acquire(&mmap_mutex);
     #endif
     memset(&mmap_list, 0, sizeof(struct mmap_memory_list));
     mmap_list.page_size = sysconf(_SC_PAGESIZE);
     #ifdef OPTIHEAP_THREAD_SAFE
-    pthread_mutex_unlock(&mmap_mutex);
+    adaptive_lock_release(&mmap_mutex);
     #endif
 }
 
 
+/*
+ * Return the mmap header that contains the given block header.
+ */
+struct mmap_header* mmap_header_of(struct memory_header *block)
+{
+    return (struct mmap_header *)((char *)block - offsetof(struct mmap_header, header));
+}
+
+
+/*
+ * Return the start of the mapping that holds the given block.
+ * The mmap header sits at the start of its mapping, except for over-aligned blocks
+ * where it is pushed further into the first page so that the payload lands on the alignment.
+ */
+static char* mmap_mapping_start(struct mmap_header *block)
+{
+    return (char *)((uintptr_t)block & ~(uintptr_t)(mmap_list.page_size - 1));
+}
+
+
+/*
+ * Return the length of the mapping that holds the given block, payloads always end on a page boundary.
+ */
+static size_t mmap_mapping_length(struct mmap_header *block)
+{
+    char *payload_end = (char *)(&block->header + 1) + block->header.size;
+    return (size_t)(payload_end - mmap_mapping_start(block));
+}
+
+
 /*
  * Insert a block into the mmap list.
  * This function adds the block to the end of the list.
  * It assumes that the block is already allocated and has a valid header.
  */
-void insert_into_mmap_list(struct memory_header *block) {
+void insert_into_mmap_list(struct mmap_header *block) {
     block->next = NULL;
     block->prev = mmap_list.tail;
     if (mmap_list.tail) {
@@ -54,7 +100,7 @@ void insert_into_mmap_list(struct memory_header *block) {
  * This function removes the specified block from the list.
  * It updates the head and tail pointers as necessary.
  */
-void remove_from_mmap_list(struct memory_header *block) {
+void remove_from_mmap_list(struct mmap_header *block) {
     if (block->prev) {
         block->prev->next = block->next;
     } else {
@@ -67,72 +113,408 @@ void remove_from_mmap_list(struct memory_header *block) {
     }
 }
 
-int present_in_mmap_list(struct memory_header *ptr)
+/*
+ * Record a live block in the page map, under the page holding its header.
+ * returns 0 on success, -1 if the page map could not track it
+ */
+static int track_mmap_block(struct mmap_header *block)
 {
-    struct memory_header *curr = mmap_list.head;
-    while (curr) {
-        if ((curr) == ptr) {
-            return 1; // Pointer is present in the mmap list
+    if (page_map_set(&block->header, 1, block, PAGE_MAP_MMAP) != 0) {
+        fprintf(stderr, "Error: Unable to record mmap block %p in the page map\n", (void *)(&block->header + 1));
+        return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * Return the counter of live bytes mapped for the block's kind of huge pages, or NULL for base pages.
+ */
+static size_t* huge_page_counter(struct mmap_header *block)
+{
+    if (block->huge == MMAP_HUGE_TRANSPARENT) {
+        return &mmap_list.transparent_bytes;
+    }
+    if (block->huge == MMAP_HUGE_EXPLICIT) {
+        return &mmap_list.hugetlb_bytes;
+    }
+    return NULL;
+}
+
+
+/*
+ * Check if the given header belongs to a live mmap block.
+ * The page map is consulted instead of the list of live blocks, so this takes constant time,
+ * needs no lock and never touches the memory behind a foreign pointer.
+ * returns 1 if the block is a live mmap block, otherwise returns 0
+ */
+int is_mmap_block(struct memory_header *ptr)
+{
+    uintptr_t entry = page_map_get(ptr);
+    return PAGE_MAP_KIND(entry) == PAGE_MAP_MMAP && PAGE_MAP_OWNER(entry) == (void *)mmap_header_of(ptr);
+}
+
+/*
+ * The mmap cache keeps the mappings of recently freed blocks instead of unmapping them.
+ * A cached region keeps an mmap_header at its start: the links chain it into the cache list
+ * (most recently freed first), header.size is the region length minus the header, header.magic
+ * is MMAP_FREED, header.reserved holds the time it was cached in milliseconds and huge tells
+ * whether the region is advised to use transparent huge pages. hugetlbfs mappings are never cached.
+ * Regions leave the cache when they are reused, when they are older than the decay time,
+ * or oldest first when the cache grows beyond its byte limit.
+ */
+
+static size_t mmap_cache_limit = OPTIHEAP_MMAP_CACHE_LIMIT;
+static size_t mmap_cache_decay_ms = OPTIHEAP_MMAP_CACHE_DECAY_MS;
+
+
+/*
+ * Return a monotonic clock in milliseconds, truncated to 32 bits. Ages are computed with
+ * unsigned subtraction, so the wrap-around every 49 days is harmless.
+ */
+static uint32_t mmap_clock_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)((uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000);
+}
+
+
+static size_t cached_region_length(struct mmap_header *region)
+{
+    return region->header.size + sizeof(struct mmap_header);
+}
+
+
+static void unlink_cached_region(struct mmap_header *region)
+{
+    if (region->prev) {
+        region->prev->next = region->next;
+    } else {
+        mmap_list.cache_head = region->next;
+    }
+    if (region->next) {
+        region->next->prev = region->prev;
+    } else {
+        mmap_list.cache_tail = region->prev;
+    }
+    mmap_list.cache_bytes -= cached_region_length(region);
+}
+
+
+/*
+ * Unmap cached regions, oldest first, until the cache holds at most limit bytes
+ * and no region is older than the decay time.
+ * The caller must hold mmap_mutex when thread safety is enabled.
+ */
+static void trim_mmap_cache(size_t limit)
+{
+    if (!mmap_list.cache_tail) {
+        return;
+    }
+    uint32_t now = mmap_clock_ms();
+    while (mmap_list.cache_tail) {
+        struct mmap_header *oldest = mmap_list.cache_tail;
+        if (mmap_list.cache_bytes <= limit && (uint32_t)(now - oldest->header.reserved) < mmap_cache_decay_ms) {
+            break;
         }
-        curr = curr->next;
+        unlink_cached_region(oldest);
+        munmap(oldest, cached_region_length(oldest));
     }
-    return 0; // Pointer not found in the mmap list
 }
 
+
+/*
+ * Park a page-aligned region in the mmap cache, huge is the MMAP_HUGE_* kind it was mapped for.
+ * returns 1 if the region was cached, 0 if it is larger than the cache and must be unmapped by the caller
+ */
+static int cache_region(char *start, size_t length, size_t huge)
+{
+    if (length > mmap_cache_limit) {
+        trim_mmap_cache(mmap_cache_limit); // Still let old regions decay
+        return 0;
+    }
+    trim_mmap_cache(mmap_cache_limit - length);
+
+    struct mmap_header *region = (struct mmap_header *)start;
+    region->header.size = length - sizeof(struct mmap_header);
+    region->header.magic = MMAP_FREED;
+    region->header.reserved = mmap_clock_ms();
+    region->huge = huge;
+    region->prev = NULL;
+    region->next = mmap_list.cache_head;
+    if (mmap_list.cache_head) {
+        mmap_list.cache_head->prev = region;
+    } else {
+        mmap_list.cache_tail = region;
+    }
+    mmap_list.cache_head = region;
+    mmap_list.cache_bytes += length;
+    return 1;
+}
+
+
+/*
+ * Take the best fitting cached region of at least length bytes out of the cache.
+ * A region that is much larger is split: a remainder large enough to serve another mmap block
+ * goes back to the cache, a smaller one is unmapped, and a small excess stays with the block.
+ * returns the region with header.size set to its usable size, or NULL if nothing fits
+ */
+static struct mmap_header* take_cached_region(size_t length)
+{
+    struct mmap_header *best = NULL;
+    for (struct mmap_header *curr = mmap_list.cache_head; curr; curr = curr->next) {
+        size_t curr_length = cached_region_length(curr);
+        if (curr_length >= length && (!best || curr_length < cached_region_length(best))) {
+            best = curr;
+            if (curr_length == length) {
+                break;
+            }
+        }
+    }
+    if (!best) {
+        trim_mmap_cache(mmap_cache_limit); // Nothing fits, but old regions may have to decay
+        return NULL;
+    }
+
+    unlink_cached_region(best);
+    size_t excess = cached_region_length(best) - length;
+    if (excess > length / 8) {
+        char *rest = (char *)best + length;
+        if (excess < OPTIHEAP_MMAP_CACHE_MIN_SPLIT || !cache_region(rest, excess, best->huge)) {
+            munmap(rest, excess);
+        }
+        best->header.size = length - sizeof(struct mmap_header);
+    }
+    return best;
+}
+
+
+/*
+ * Set the number of bytes of freed mappings the mmap cache may keep, 0 disables the cache.
+ */
+void mmap_cache_set_limit(size_t limit)
+{
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_acquire(&mmap_mutex);
+    #endif
+    mmap_cache_limit = limit;
+    trim_mmap_cache(limit);
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_release(&mmap_mutex);
+    #endif
+}
+
+
+size_t mmap_cache_get_limit(void)
+{
+    return mmap_cache_limit;
+}
+
+
+/*
+ * Set how long a freed mapping may stay in the mmap cache before it is returned to the OS.
+ * Expired regions are released lazily by the next mmap allocation or free.
+ */
+void mmap_cache_set_decay(size_t decay_ms)
+{
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_acquire(&mmap_mutex);
+    #endif
+    mmap_cache_decay_ms = decay_ms;
+    trim_mmap_cache(mmap_cache_limit);
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_release(&mmap_mutex);
+    #endif
+}
+
+
+size_t mmap_cache_get_decay(void)
+{
+    return mmap_cache_decay_ms;
+}
+
+
 /*
  * Allocate a memory block using mmap.
- * This function allocates a block of memory of at least the requested size,
- * aligned to the page size, and returns a pointer to the usable memory area.
+ * A cached region of a recently freed block is reused when one is large enough, so the
+ * common allocate/free cycle of large buffers costs neither a syscall nor fresh page faults.
+ * Otherwise this function maps a block of at least the requested size, aligned to the page size.
+ * With huge pages enabled, blocks of a huge page or more are mapped in whole huge pages through huge_page_map.
+ * If zeroed is set the first requested_size bytes of the payload are guaranteed to be zero.
  */
-void* allocate_mmap_block(size_t requested_size)
+static void* allocate_mmap_block_internal(size_t requested_size, int zeroed)
 {
     if (requested_size == 0)
     {
         return NULL;
     }
+    // Room for rounding up to a huge page covers the base page rounding as well
+    if (requested_size > SIZE_MAX - sizeof(struct mmap_header) - HUGE_PAGE_SIZE)
+    {
+        fprintf(stderr, "Error: Allocation of %zu bytes overflows size_t\n", requested_size);
+        return ALLOCATION_FAILED;
+    }
 
     #ifdef OPTIHEAP_THREAD_SAFE
-    pthread_mutex_lock(&mmap_mutex);
+    adaptive_lock_acquire(&mmap_mutex);
     #endif
 
     void * allocation_ptr = NULL;;
+    int recycled = 0;
 
     // Here bitwise operations are used to align the size to the page size because page size is a power of two.
-    size_t aligned_size = (requested_size + sizeof(struct memory_header) + mmap_list.page_size - 1) & ~(mmap_list.page_size - 1);
-    
-    struct memory_header *new_block = mmap(NULL, aligned_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    size_t aligned_size = (requested_size + sizeof(struct mmap_header) + mmap_list.page_size - 1) & ~(mmap_list.page_size - 1);
+    int huge = huge_page_mode != OPTIHEAP_HUGE_PAGES_OFF && aligned_size >= HUGE_PAGE_SIZE;
+    if (huge) {
+        aligned_size = HUGE_PAGE_ALIGN(aligned_size);
+    }
 
-    if (new_block == MAP_FAILED)
-    {
-        fprintf(stderr, "Error: mmap failed to allocate %zu bytes\n", aligned_size);
+    struct mmap_header *new_block = take_cached_region(aligned_size);
+    if (new_block) {
+        // Recycled regions carry stale data, the list links are rewritten on insertion
+        size_t region_size = new_block->header.size;
+        memset(&new_block->header, 0, sizeof(struct memory_header));
+        new_block->header.size = region_size;
+        recycled = 1;
+    } else {
+        int hugetlb = 0;
+        if (huge) {
+            new_block = huge_page_map(aligned_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, &hugetlb);
+        } else {
+            new_block = mmap(NULL, aligned_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        }
+
+        if (new_block == MAP_FAILED)
+        {
+            fprintf(stderr, "Error: mmap failed to allocate %zu bytes\n", aligned_size);
+            allocation_ptr = ALLOCATION_FAILED;
+            goto END;
+        }
+
+        // Fresh mappings are zero-filled, so only the non-zero fields need to be set
+        new_block->header.size = aligned_size - sizeof(struct mmap_header); // Store the size excluding the header
+        if (huge) {
+            new_block->huge = hugetlb ? MMAP_HUGE_EXPLICIT : MMAP_HUGE_TRANSPARENT;
+        }
+    }
+    if (track_mmap_block(new_block) != 0) {
+        munmap(new_block, new_block->header.size + sizeof(struct mmap_header));
         allocation_ptr = ALLOCATION_FAILED;
         goto END;
     }
+    new_block->header.magic = MMAP_ALLOCATED;
+    new_block->header.reserved = mmap_clock_ms(); // Allocation time, for the adaptive threshold
+
+    insert_into_mmap_list(new_block);
+    size_t *huge_bytes = huge_page_counter(new_block);
+    if (huge_bytes) {
+        *huge_bytes += mmap_mapping_length(new_block);
+    }
+
+    allocation_ptr = (void *)(&new_block->header + 1);
+
+    END:
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_release(&mmap_mutex);
+    #endif
+    if (zeroed && recycled && allocation_ptr != ALLOCATION_FAILED) {
+        memset(allocation_ptr, 0, requested_size); // The block is ours now, so it is cleared outside of the lock
+    }
+    return allocation_ptr; 
+}
+
+
+void* allocate_mmap_block(size_t requested_size)
+{
+    return allocate_mmap_block_internal(requested_size, 0);
+}
+
+
+/*
+ * Allocate a memory block using mmap whose first requested_size bytes are zero.
+ * Fresh mappings are zero-filled by the kernel, only recycled regions are cleared.
+ */
+void* allocate_mmap_block_zeroed(size_t requested_size)
+{
+    return allocate_mmap_block_internal(requested_size, 1);
+}
+
+
+/*
+ * Allocate a memory block using mmap whose payload is aligned to alignment bytes.
+ * alignment must be a power of two. The mapping is over-sized by alignment, then the
+ * whole pages in front of the header and behind the payload are unmapped again,
+ * so at most one page of padding is kept in front of the header.
+ */
+void* allocate_mmap_block_aligned(size_t alignment, size_t requested_size)
+{
+    if (requested_size == 0)
+    {
+        return NULL;
+    }
+    size_t page_mask = mmap_list.page_size - 1;
+    if (requested_size > SIZE_MAX - sizeof(struct mmap_header) - page_mask || alignment > SIZE_MAX - sizeof(struct mmap_header) - page_mask - requested_size)
+    {
+        fprintf(stderr, "Error: Allocation of %zu bytes aligned to %zu overflows size_t\n", requested_size, alignment);
+        return ALLOCATION_FAILED;
+    }
+
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_acquire(&mmap_mutex);
+    #endif
+
+    void *allocation_ptr = NULL;
+    size_t mapped_size = (requested_size + sizeof(struct mmap_header) + alignment + page_mask) & ~page_mask;
 
-    memset(new_block, 0, sizeof(struct memory_header));
-    new_block->magic = MMAP_ALLOCATED;
-    new_block->size = aligned_size - sizeof(struct memory_header); // Store the size excluding the header
+    char *mapping = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 
-    if (!mmap_list.head)
+    if (mapping == MAP_FAILED)
     {
-        mmap_list.head = new_block;
+        fprintf(stderr, "Error: mmap failed to allocate %zu bytes\n", mapped_size);
+        allocation_ptr = ALLOCATION_FAILED;
+        goto END;
+    }
+
+    uintptr_t payload = ((uintptr_t)mapping + sizeof(struct mmap_header) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    char *start = (char *)((payload - sizeof(struct mmap_header)) & ~(uintptr_t)page_mask);
+    char *end = (char *)((payload + requested_size + page_mask) & ~(uintptr_t)page_mask);
+
+    // Give the padding on both sides back to the kernel
+    if (start > mapping) {
+        munmap(mapping, (size_t)(start - mapping));
+    }
+    if (end < mapping + mapped_size) {
+        munmap(end, (size_t)(mapping + mapped_size - end));
+    }
+
+    struct mmap_header *new_block = (struct mmap_header *)(payload - sizeof(struct mmap_header));
+    if (track_mmap_block(new_block) != 0) {
+        munmap(start, (size_t)(end - start));
+        allocation_ptr = ALLOCATION_FAILED;
+        goto END;
     }
+    new_block->header.magic = MMAP_ALLOCATED;
+    new_block->header.size = (size_t)(end - (char *)payload);
+    new_block->huge = MMAP_HUGE_NONE;
+    new_block->header.reserved = mmap_clock_ms(); // Allocation time, for the adaptive threshold
 
     insert_into_mmap_list(new_block);
 
-    allocation_ptr = (void *)(new_block + 1);
+    allocation_ptr = (void *)payload;
 
     END:
     #ifdef OPTIHEAP_THREAD_SAFE
-    pthread_mutex_unlock(&mmap_mutex);
+    adaptive_lock_release(&mmap_mutex);
     #endif
-    return allocation_ptr; 
+    return allocation_ptr;
 }
 
 
 /*
  * Free a memory block allocated with mmap.
- * This function removes the block from the mmap list and deallocates the memory.
+ * The pointer is validated through the page map before its header is read, so foreign pointers
+ * are rejected in every build, and then handed to release_mmap_block.
  * returns NULL if deallocation is successful
  * returns DEALLOCATION_FAILED if deallocation fails
  */
@@ -143,56 +525,255 @@ void* free_mmap_block(void *ptr)
         return NULL; // No action for null pointer
     }
 
+    if (!is_mmap_block((struct memory_header *)ptr - 1)) {
+        fprintf(stderr, "Error: Attempt to free a pointer %p is not present in the memory, either it has already been freed or was never allocated by mmap.\n", ptr);
+        return DEALLOCATION_FAILED;
+    }
+    return release_mmap_block(ptr);
+}
+
+
+/*
+ * Free a memory block that is_mmap_block already found in the page map.
+ * This function removes the block from the mmap list and parks its mapping in the mmap cache,
+ * or unmaps it if the cache has no room for it. The magic is still checked under the lock.
+ * returns NULL if deallocation is successful
+ * returns DEALLOCATION_FAILED if deallocation fails
+ */
+void* release_mmap_block(void *ptr)
+{
     void * status = NULL; // Default to NULL for successful deallocation
-    struct memory_header *block = (struct memory_header *)ptr - 1; // Get the header from the pointer
+    struct memory_header *header = (struct memory_header *)ptr - 1; // Get the header from the pointer
+    struct mmap_header *block = mmap_header_of(header);
 
     #ifdef OPTIHEAP_THREAD_SAFE
-    pthread_mutex_lock(&mmap_mutex);
+    adaptive_lock_acquire(&mmap_mutex);
     #endif
 
-    #ifdef OPTIHEAP_DEBUGGER
+    if (header->magic != MMAP_ALLOCATED) {
+        fprintf(stderr, "Error: Attempt to free a block that is not allocated or has been corrupted.\n");
+        status = DEALLOCATION_FAILED;
+        goto END;
+    }
 
-    if(present_in_mmap_list(block)) {
-        if (block->magic != MMAP_ALLOCATED) {
-            fprintf(stderr, "Error: Attempt to free a block that is not allocated or has been corrupted.\n");
-            #ifdef OPTIHEAP_THREAD_SAFE
-            pthread_mutex_unlock(&mmap_mutex);
-            #endif
-            status = DEALLOCATION_FAILED;
-            goto END;
-        }
+    // A short-lived block shows that blocks of its size churn, let the heap serve them from now on
+    if (!mmap_threshold_pinned && header->size > mmap_threshold && header->size <= mmap_threshold_max &&
+        (uint32_t)(mmap_clock_ms() - header->reserved) < OPTIHEAP_MMAP_SHORT_LIVED_MS) {
+        mmap_threshold = header->size;
+    }
 
-        // Remove the block from the mmap list
-        remove_from_mmap_list(block);
+    // Remove the block from the mmap list and the page map
+    remove_from_mmap_list(block);
+    page_map_clear(header, 1);
+    header->magic = MMAP_FREED;
+
+    char *mapping = mmap_mapping_start(block);
+    size_t length = mmap_mapping_length(block);
+    size_t huge = block->huge;
+    size_t *huge_bytes = huge_page_counter(block);
+    if (huge_bytes) {
+        *huge_bytes -= length;
+    }
+    // hugetlbfs pages go straight back to their pool, where other processes may be waiting for them
+    int cached = huge != MMAP_HUGE_EXPLICIT && cache_region(mapping, length, huge);
+    if (!cached && munmap(mapping, length) == -1) {
+        fprintf(stderr, "Error: munmap failed to deallocate memory.\n");
+        status =  DEALLOCATION_FAILED; // Indicate failure
+    }
 
-        // Unmap the memory
-        if (munmap(block, block->size + sizeof(struct memory_header)) == -1) {
-            fprintf(stderr, "Error: munmap failed to deallocate memory.\n");
-            status =  DEALLOCATION_FAILED; // Indicate failure
-            goto END;
-        }
+    END:
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_release(&mmap_mutex);
+    #endif
+    return status;
+}
+
+
+/*
+ * Resize a memory block allocated with mmap.
+ * The mapping is resized with mremap(MREMAP_MAYMOVE), so growth is page-table
+ * remapping done by the kernel instead of a copy of the payload.
+ * Blocks advised to use transparent huge pages grow in whole huge pages and move to aligned addresses,
+ * hugetlbfs mappings cannot be resized by base pages, they are kept when the block shrinks.
+ * returns the (possibly moved) pointer to the payload on success
+ * returns NULL if a hugetlbfs block has to grow, the caller then moves it to a new block
+ * returns ALLOCATION_FAILED if the block is invalid, requested_size is too large to map, the block could not be
+ * remapped or its new address could not be tracked, the block is then left untouched
+ */
+void* reallocate_mmap_block(void *ptr, size_t requested_size)
+{
+    struct memory_header *header = (struct memory_header *)ptr - 1;
+    struct mmap_header *block = mmap_header_of(header);
+    void *allocation_ptr = ALLOCATION_FAILED;
+
+    if (!is_mmap_block(header)) {
+        fprintf(stderr, "Error: Attempt to reallocate a pointer %p that is not present in the memory.\n", ptr);
+        return ALLOCATION_FAILED;
     }
-    else
-    {
-        status = DEALLOCATION_FAILED;
-        fprintf(stderr, "Error: Attempt to free a pointer %p is not present in the memory, either it has already been freed or was never allocated by mmap.\n", ptr);
+
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_acquire(&mmap_mutex);
+    #endif
+
+    if (header->magic != MMAP_ALLOCATED) {
+        fprintf(stderr, "Error: Attempt to reallocate a block that is not allocated or has been corrupted.\n");
+        goto END;
     }
-    
-    #else
-    
-    remove_from_mmap_list(block);
-    if (munmap(block, block->size + sizeof(struct memory_header)) == -1) {
-        status =  DEALLOCATION_FAILED;
+    if (block->huge == MMAP_HUGE_EXPLICIT) {
+        allocation_ptr = requested_size <= header->size ? ptr : NULL;
         goto END;
     }
 
-    #endif
+    char *mapping = mmap_mapping_start(block);
+    size_t offset = (size_t)((char *)block - mapping); // Kept by mremap, so over-aligned payloads stay aligned to the page
+    size_t old_size = mmap_mapping_length(block);
+    // Room for rounding up to a huge page covers the base page rounding as well
+    if (requested_size > SIZE_MAX - offset - sizeof(struct mmap_header) - HUGE_PAGE_SIZE) {
+        fprintf(stderr, "Error: Reallocation to %zu bytes overflows size_t\n", requested_size);
+        goto END;
+    }
+    size_t new_size = (offset + sizeof(struct mmap_header) + requested_size + mmap_list.page_size - 1) & ~(mmap_list.page_size - 1);
+
+    int huge = block->huge == MMAP_HUGE_TRANSPARENT && new_size >= HUGE_PAGE_SIZE;
+    if (huge) {
+        new_size = HUGE_PAGE_ALIGN(new_size); // These blocks have their header at the start of the mapping
+    }
+
+    if (new_size != old_size) {
+        char *remapped;
+        if (huge && new_size > old_size) {
+            remapped = huge_page_remap(mapping, old_size, new_size);
+        } else {
+            remapped = mremap(mapping, old_size, new_size, MREMAP_MAYMOVE);
+        }
+        if (remapped == MAP_FAILED) {
+            fprintf(stderr, "Error: mremap failed to resize %zu bytes to %zu bytes\n", old_size, new_size);
+            goto END;
+        }
+        struct mmap_header *moved = (struct mmap_header *)(remapped + offset);
+        if (moved != block) {
+            if (track_mmap_block(moved) == -1) {
+                // Move the mapping back, so ptr and its page map entry stay valid for the caller
+                if (mremap(remapped, new_size, old_size, MREMAP_MAYMOVE | MREMAP_FIXED, mapping) == MAP_FAILED) {
+                    fprintf(stderr, "Error: mremap failed to move %zu bytes back to %p, the block is lost\n", old_size, (void *)mapping);
+                    page_map_clear(&block->header, 1);
+                    remove_from_mmap_list(moved); // The neighbours are relinked, so leak walks do not reach the old address
+                    size_t *huge_bytes = huge_page_counter(moved);
+                    if (huge_bytes) {
+                        *huge_bytes -= old_size;
+                    }
+                    munmap(remapped, new_size);
+                }
+                goto END;
+            }
+            page_map_clear(&block->header, 1);
+            // The neighbours still point at the old address
+            if (moved->prev) {
+                moved->prev->next = moved;
+            } else {
+                mmap_list.head = moved;
+            }
+            if (moved->next) {
+                moved->next->prev = moved;
+            } else {
+                mmap_list.tail = moved;
+            }
+            block = moved;
+        }
+        block->header.size = new_size - offset - sizeof(struct mmap_header);
+        size_t *huge_bytes = huge_page_counter(block);
+        if (huge_bytes) {
+            *huge_bytes += new_size - old_size; // mremap keeps the advice, the counter wraps back on a shrink
+        }
+    }
+
+    allocation_ptr = (void *)(&block->header + 1);
 
     END:
     #ifdef OPTIHEAP_THREAD_SAFE
-    pthread_mutex_unlock(&mmap_mutex);
+    adaptive_lock_release(&mmap_mutex);
+    #endif
+    return allocation_ptr;
+}
+
+
+/*
+ * Unmap every cached region.
+ * returns 1 if any region was released, otherwise returns 0
+ */
+int mmap_cache_release(void)
+{
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_acquire(&mmap_mutex);
+    #endif
+    int released = mmap_list.cache_head != NULL;
+    while (mmap_list.cache_tail) {
+        struct mmap_header *oldest = mmap_list.cache_tail;
+        unlink_cached_region(oldest);
+        munmap(oldest, cached_region_length(oldest));
+    }
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_release(&mmap_mutex);
+    #endif
+    return released;
+}
+
+
+/*
+ * Pin the threshold above which allocations are served by mmap, this stops its adaptation.
+ */
+void mmap_threshold_set(size_t threshold)
+{
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_acquire(&mmap_mutex);
+    #endif
+    mmap_threshold = threshold;
+    mmap_threshold_pinned = 1;
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_release(&mmap_mutex);
+    #endif
+}
+
+
+/*
+ * Set the ceiling of the adaptive threshold and resume adapting,
+ * a threshold that is already higher is lowered to the new ceiling.
+ */
+void mmap_threshold_set_max(size_t threshold_max)
+{
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_acquire(&mmap_mutex);
+    #endif
+    mmap_threshold_max = threshold_max;
+    mmap_threshold_pinned = 0;
+    if (mmap_threshold > threshold_max) {
+        mmap_threshold = threshold_max;
+    }
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_release(&mmap_mutex);
+    #endif
+}
+
+
+size_t mmap_threshold_get_max(void)
+{
+    return mmap_threshold_max;
+}
+
+
+/*
+ * Report the bytes of live blocks advised to use transparent huge pages and mapped from hugetlbfs.
+ */
+void mmap_huge_page_bytes(size_t *transparent_bytes, size_t *hugetlb_bytes)
+{
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_acquire(&mmap_mutex);
+    #endif
+    *transparent_bytes = mmap_list.transparent_bytes;
+    *hugetlb_bytes = mmap_list.hugetlb_bytes;
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_release(&mmap_mutex);
     #endif
-    return status;
 }
 
 
@@ -200,22 +781,31 @@ void debug_print_mmap([[maybe_unused]]int debug_id)
 {
     #ifdef OPTIHEAP_DEBUGGER
     #ifdef OPTIHEAP_THREAD_SAFE
-    pthread_mutex_lock(&mmap_mutex);
+    adaptive_lock_acquire(&mmap_mutex);
     #endif
-    struct memory_header *curr = mmap_list.head;
+    struct mmap_header *curr = mmap_list.head;
     printf("================================================================= START DEBUG_ID : %d\n", debug_id);
     printf("MMapped Memory State:\n");
     while (curr) {
-        printf("Block at %p: \t State=%s \tdata_size=%zu, total_size=%zu\n",
+        printf("Block at %p: \t State=%s \tdata_size=%zu, total_size=%zu, pages=%s\n",
             (void*)curr,
-            curr->magic == MMAP_ALLOCATED ? "ALLOCATED" : "CORRUPTED",
-            curr->size,
-            curr->size + sizeof(struct memory_header));
+            curr->header.magic == MMAP_ALLOCATED ? "ALLOCATED" : "CORRUPTED",
+            curr->header.size,
+            mmap_mapping_length(curr),
+            curr->huge == MMAP_HUGE_EXPLICIT ? "HUGETLB" : curr->huge == MMAP_HUGE_TRANSPARENT ? "THP" : "BASE");
         curr = curr->next;
     }
+    printf("Huge page blocks: %zu bytes transparent, %zu bytes hugetlb\n", mmap_list.transparent_bytes, mmap_list.hugetlb_bytes);
+    printf("Cached regions: %zu bytes\n", mmap_list.cache_bytes);
+    for (curr = mmap_list.cache_head; curr; curr = curr->next) {
+        printf("Region at %p: \t State=%s \ttotal_size=%zu\n",
+            (void*)curr,
+            curr->header.magic == MMAP_FREED ? "CACHED" : "CORRUPTED",
+            cached_region_length(curr));
+    }
     printf("================================================================= END DEBUG_ID : %d\n", debug_id);
     #ifdef OPTIHEAP_THREAD_SAFE
-    pthread_mutex_unlock(&mmap_mutex);
+    adaptive_lock_release(&mmap_mutex);
     #endif
     #else
     printf("Warning: OptiHeap Debugger is disabled. Enable it by compiling with -DOPTIHEAP_DEBUGGER flag to see mmap state.\n");
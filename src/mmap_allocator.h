@@ -5,24 +5,89 @@
 #define DEALLOCATION_FAILED ((void*)-2)
 
 #include <stddef.h>
+#include "memory_structs.h"
+
+/*
+ * Header placed at the start of every mapping (over-aligned blocks push it further into the first page).
+ * The list links live in front of the common memory_header so that ptr - 1 is the
+ * memory_header for heap and mmap blocks alike.
+ */
+struct mmap_header {
+    struct mmap_header *next; // Next in mmap list
+    struct mmap_header *prev; // Prev in mmap list
+    size_t huge; // MMAP_HUGE_* kind of huge pages the mapping was made for
+    size_t reserved; // Keeps the payload 16-byte aligned
+    struct memory_header header; // Must stay last, the payload follows it directly
+};
+
+#define MMAP_HUGE_NONE 0 // Base pages
+#define MMAP_HUGE_TRANSPARENT 1 // 2 MiB aligned and advised to use transparent huge pages
+#define MMAP_HUGE_EXPLICIT 2 // Mapped from hugetlbfs with MAP_HUGETLB, its length is a multiple of HUGE_PAGE_SIZE
+
+#define MAX_HEAP_ALLOC_SIZE (1024 * 128) // Initial threshold above which allocations are served by mmap
+
+// Ceiling for the adaptive threshold, it is never raised beyond this
+#ifndef OPTIHEAP_MMAP_THRESHOLD_MAX
+#define OPTIHEAP_MMAP_THRESHOLD_MAX (32 * 1024 * 1024)
+#endif
+
+// An mmap block freed within this many milliseconds of its allocation raises the threshold
+#define OPTIHEAP_MMAP_SHORT_LIVED_MS 1000
+
+// Bytes of freed mappings kept for reuse until tuned through optiheap_set_option()
+#ifndef OPTIHEAP_MMAP_CACHE_LIMIT
+#define OPTIHEAP_MMAP_CACHE_LIMIT (32 * 1024 * 1024)
+#endif
+
+// Milliseconds a freed mapping stays cached before it is returned to the OS
+#ifndef OPTIHEAP_MMAP_CACHE_DECAY_MS
+#define OPTIHEAP_MMAP_CACHE_DECAY_MS 1000
+#endif
+
+// Smallest remainder of a split cached region that is worth caching on its own
+#define OPTIHEAP_MMAP_CACHE_MIN_SPLIT (128 * 1024)
 
 struct mmap_memory_list {
     size_t page_size;
-    struct memory_header *head; // First block in list
-    struct memory_header *tail; // Last block in list
+    struct mmap_header *head; // First block in list
+    struct mmap_header *tail; // Last block in list
+
+    // Mappings of freed blocks kept for reuse, most recently freed first
+    struct mmap_header *cache_head;
+    struct mmap_header *cache_tail;
+    size_t cache_bytes;
+
+    // Bytes of live blocks by the kind of huge pages they were mapped for
+    size_t transparent_bytes;
+    size_t hugetlb_bytes;
 };
 
 extern struct mmap_memory_list mmap_list;
+extern size_t mmap_threshold; // Requests larger than this are served by mmap
 
 #ifdef OPTIHEAP_THREAD_SAFE
-#include <pthread.h>
-extern pthread_mutex_t mmap_mutex; // Mutex for thread safety
+#include "adaptive_lock.h"
+extern struct adaptive_lock mmap_mutex; // Lock for thread safety
 #endif
 
 void mmap_allocator_init(void);
 void* allocate_mmap_block(size_t size);
+void* allocate_mmap_block_zeroed(size_t size);
+void* allocate_mmap_block_aligned(size_t alignment, size_t size);
 void* free_mmap_block(void* ptr);
-int present_in_mmap_list(struct memory_header *ptr);
+void* release_mmap_block(void *ptr);
+void* reallocate_mmap_block(void *ptr, size_t requested_size);
+int is_mmap_block(struct memory_header *ptr);
+struct mmap_header* mmap_header_of(struct memory_header *block);
+void mmap_cache_set_limit(size_t limit);
+size_t mmap_cache_get_limit(void);
+void mmap_cache_set_decay(size_t decay_ms);
+size_t mmap_cache_get_decay(void);
+int mmap_cache_release(void);
+void mmap_threshold_set(size_t threshold);
+void mmap_threshold_set_max(size_t threshold_max);
+size_t mmap_threshold_get_max(void);
+void mmap_huge_page_bytes(size_t *transparent_bytes, size_t *hugetlb_bytes);
 void debug_print_mmap(int debug_id);
 
 #endif // MMAP_ALLOCATOR_H
\ No newline at end of file
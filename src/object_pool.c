@@ -0,0 +1,236 @@
+#include "object_pool.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * This file implements fixed-size object pools. A pool packs its objects back to back
+ * in large chunks, with no header and no rounding beyond the requested alignment, so
+ * allocating and freeing are a push or a pop on the pool's free list, after a binary search
+ * of the chunks that finds the object's bit in its chunk's allocated bitmap and validates the freed pointer.
+ * The chunks are only returned when the pool is destroyed, which releases all its objects at once.
+ */
+
+
+/*
+ * This function creates a pool of objects of object_size bytes aligned to alignment.
+ * alignment must be 0 or a power of two, 0 selects the largest power of two dividing
+ * object_size, between the alignment of a pointer and 16.
+ * It returns the pool, or NULL if the arguments are invalid or no memory is available.
+ */
+struct optiheap_pool* optiheap_pool_create(size_t object_size, size_t alignment)
+{
+    if (object_size == 0 || object_size > SIZE_MAX / 2) {
+        fprintf(stderr, "Error: Pool object size %zu is not supported\n", object_size);
+        return NULL;
+    }
+    if ((alignment & (alignment - 1)) != 0 || alignment > OPTIHEAP_POOL_CHUNK_SIZE) {
+        fprintf(stderr, "Error: Pool alignment %zu is not a supported power of two\n", alignment);
+        return NULL;
+    }
+    if (alignment == 0) {
+        alignment = object_size & -object_size; // Lowest set bit
+        if (alignment > 16) {
+            alignment = 16;
+        }
+    }
+    if (alignment < sizeof(void *)) {
+        alignment = sizeof(void *); // Free objects hold a pointer
+    }
+
+    struct optiheap_pool *pool = optiheap_allocate(sizeof(struct optiheap_pool));
+    if (pool == ALLOCATION_FAILED) {
+        fprintf(stderr, "Error: Unable to allocate a pool\n");
+        return NULL;
+    }
+    pool->free_list = NULL;
+    pool->curr = NULL;
+    pool->end = NULL;
+    pool->chunks = NULL;
+    pool->chunk_index = NULL;
+    pool->chunk_count = 0;
+    pool->chunk_index_capacity = 0;
+    pool->stride = (object_size + alignment - 1) & ~(alignment - 1);
+    pool->alignment = alignment;
+    size_t objects = (OPTIHEAP_POOL_CHUNK_SIZE - sizeof(struct pool_chunk)) / pool->stride; // Upper bound for the bitmap
+    pool->bitmap_words = ((objects ? objects : 1) + 63) / 64;
+    pool->offset = (sizeof(struct pool_chunk) + pool->bitmap_words * sizeof(uint64_t) + alignment - 1) & ~(alignment - 1);
+    objects = pool->offset < OPTIHEAP_POOL_CHUNK_SIZE ? (OPTIHEAP_POOL_CHUNK_SIZE - pool->offset) / pool->stride : 0;
+    pool->chunk_size = pool->offset + (objects ? objects : 1) * pool->stride;
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_init(&pool->lock);
+    #endif
+    return pool;
+}
+
+
+/*
+ * This function returns how many chunks of the pool start at or below address.
+ */
+static size_t pool_chunks_below(struct optiheap_pool *pool, char *address)
+{
+    size_t low = 0, high = pool->chunk_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (pool->chunk_index[middle] <= address) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+
+/*
+ * This function adds a new chunk to the pool's sorted chunk index, growing the index if it is full.
+ * It returns 0 on success, or -1 if the index could not be grown.
+ */
+static int pool_index_chunk(struct optiheap_pool *pool, struct pool_chunk *chunk)
+{
+    if (pool->chunk_count == pool->chunk_index_capacity) {
+        size_t capacity = pool->chunk_index_capacity ? pool->chunk_index_capacity * 2 : 16;
+        char **index = optiheap_reallocate(pool->chunk_index, capacity * sizeof(char *));
+        if (index == ALLOCATION_FAILED) {
+            return -1;
+        }
+        pool->chunk_index = index;
+        pool->chunk_index_capacity = capacity;
+    }
+    size_t position = pool_chunks_below(pool, (char *)chunk);
+    memmove(&pool->chunk_index[position + 1], &pool->chunk_index[position], (pool->chunk_count - position) * sizeof(char *));
+    pool->chunk_index[position] = (char *)chunk;
+    pool->chunk_count++;
+    return 0;
+}
+
+
+/*
+ * This function checks that ptr is the start of an object carved from one of the pool's chunks,
+ * with a binary search of the chunk index, one range test and one modulo.
+ * It returns the chunk and stores the object's index in it in *index, or returns NULL if it is not.
+ */
+static struct pool_chunk* pool_owns(struct optiheap_pool *pool, void *ptr, size_t *index)
+{
+    size_t position = pool_chunks_below(pool, ptr);
+    if (position == 0) {
+        return NULL;
+    }
+    char *chunk = pool->chunk_index[position - 1];
+    char *first = chunk + pool->offset;
+    char *limit = chunk == (char *)pool->chunks ? pool->curr : chunk + pool->chunk_size;
+    if ((char *)ptr < first || (char *)ptr >= limit || ((size_t)((char *)ptr - first) % pool->stride) != 0) {
+        return NULL;
+    }
+    *index = (size_t)((char *)ptr - first) / pool->stride;
+    return (struct pool_chunk *)chunk;
+}
+
+
+/*
+ * This function allocates one object from a pool: the most recently freed one if there is one,
+ * else the next never-used object of the newest chunk, else the first object of a new chunk.
+ * It returns the object, or ALLOCATION_FAILED if no chunk could be allocated.
+ */
+void* optiheap_pool_alloc(struct optiheap_pool *pool)
+{
+    void *object;
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_acquire(&pool->lock);
+    #endif
+
+    object = pool->free_list;
+    if (object) {
+        pool->free_list = *(void **)object;
+        size_t index;
+        struct pool_chunk *owner = pool_owns(pool, object, &index);
+        owner->allocated[index / 64] |= (uint64_t)1 << (index % 64);
+        goto END;
+    }
+    if (pool->curr == pool->end) {
+        struct pool_chunk *chunk = optiheap_aligned_allocate(pool->alignment, pool->chunk_size);
+        if (chunk == ALLOCATION_FAILED) {
+            fprintf(stderr, "Error: Unable to allocate a %zu byte pool chunk\n", pool->chunk_size);
+            object = ALLOCATION_FAILED;
+            goto END;
+        }
+        if (pool_index_chunk(pool, chunk) != 0) {
+            fprintf(stderr, "Error: Unable to grow the chunk index of pool %p\n", (void *)pool);
+            optiheap_free(chunk);
+            object = ALLOCATION_FAILED;
+            goto END;
+        }
+        chunk->next = pool->chunks;
+        memset(chunk->allocated, 0, pool->bitmap_words * sizeof(uint64_t));
+        pool->chunks = chunk;
+        pool->curr = (char *)chunk + pool->offset;
+        pool->end = (char *)chunk + pool->chunk_size;
+    }
+    object = pool->curr;
+    size_t index = (size_t)(pool->curr - ((char *)pool->chunks + pool->offset)) / pool->stride;
+    pool->chunks->allocated[index / 64] |= (uint64_t)1 << (index % 64);
+    pool->curr += pool->stride;
+
+END:
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_release(&pool->lock);
+    #endif
+    return object;
+}
+
+
+/*
+ * This function returns an object to the pool it was allocated from, after checking that
+ * the object belongs to the pool and is still allocated.
+ * It returns NULL on success, or DEALLOCATION_FAILED if the object is rejected.
+ */
+void* optiheap_pool_free(struct optiheap_pool *pool, void *ptr)
+{
+    void *result = NULL;
+    if (!ptr) {
+        return NULL;
+    }
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_acquire(&pool->lock);
+    #endif
+
+    size_t index = 0;
+    struct pool_chunk *chunk = pool_owns(pool, ptr, &index);
+    uint64_t bit = (uint64_t)1 << (index % 64);
+    if (!chunk) {
+        fprintf(stderr, "Error: Pointer %p is not an object of pool %p\n", ptr, (void *)pool);
+        result = DEALLOCATION_FAILED;
+    } else if (!(chunk->allocated[index / 64] & bit)) {
+        fprintf(stderr, "Error: Double free of object %p of pool %p\n", ptr, (void *)pool);
+        result = DEALLOCATION_FAILED;
+    } else {
+        chunk->allocated[index / 64] &= ~bit;
+        *(void **)ptr = pool->free_list;
+        pool->free_list = ptr;
+    }
+
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_release(&pool->lock);
+    #endif
+    return result;
+}
+
+
+/*
+ * This function frees every chunk of a pool and the pool itself,
+ * releasing all its objects whether they were freed or not.
+ */
+void optiheap_pool_destroy(struct optiheap_pool *pool)
+{
+    if (!pool) {
+        return;
+    }
+    struct pool_chunk *chunk = pool->chunks;
+    while (chunk) {
+        struct pool_chunk *next = chunk->next;
+        optiheap_free(chunk);
+        chunk = next;
+    }
+    optiheap_free(pool->chunk_index);
+    optiheap_free(pool);
+}
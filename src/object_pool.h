@@ -0,0 +1,52 @@
+#ifndef OBJECT_POOL_H
+#define OBJECT_POOL_H
+
+#define ALLOCATION_FAILED ((void*)-1)
+#define DEALLOCATION_FAILED ((void*)-2)
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../include/optiheap_allocator.h"
+
+#ifdef OPTIHEAP_THREAD_SAFE
+#include "adaptive_lock.h"
+#endif
+
+// Size of the chunks a pool carves its objects from, a chunk holds at least one object
+#ifndef OPTIHEAP_POOL_CHUNK_SIZE
+#define OPTIHEAP_POOL_CHUNK_SIZE ((size_t)64 * 1024)
+#endif
+
+/*
+ * A chunk is one block from the heap or mmap tier, its objects follow the header back to back.
+ * The allocated bitmap has one bit per object, set while the object is in the caller's hands,
+ * so that a second free of the same object is caught before it corrupts the free list.
+ */
+struct pool_chunk {
+    struct pool_chunk *next; // Next chunk of the pool
+    uint64_t allocated[]; // One bit per object, set while the object is allocated
+};
+
+/*
+ * A pool serves objects of a single size. Freed objects are linked through their own first word,
+ * objects that were never used are carved on demand from the end of the newest chunk.
+ */
+struct optiheap_pool {
+    void *free_list; // Freed objects, linked through their first word
+    char *curr; // Next never-used object of the newest chunk
+    char *end; // End of the newest chunk's objects
+    struct pool_chunk *chunks; // Every chunk of the pool, newest first
+    char **chunk_index; // Start of every chunk sorted by address, for validating frees
+    size_t chunk_count; // Number of chunks in chunk_index
+    size_t chunk_index_capacity; // Entries chunk_index has room for
+    size_t stride; // Distance between two objects, the object size rounded to the alignment
+    size_t alignment; // Alignment of every object
+    size_t offset; // Offset of the first object from the start of its chunk, past the allocated bitmap
+    size_t bitmap_words; // Words of every chunk's allocated bitmap
+    size_t chunk_size; // Size of every chunk
+    #ifdef OPTIHEAP_THREAD_SAFE
+    struct adaptive_lock lock;
+    #endif
+};
+
+#endif // OBJECT_POOL_H
@@ -1,32 +1,86 @@
 #include "mmap_allocator.h"
 #include "heap_allocator.h"
+#include "slab_allocator.h"
+#include "thread_cache.h"
+#include "huge_pages.h"
+#include "prefault.h"
+#include "adaptive_lock.h"
+#include "../include/optiheap_allocator.h"
 #include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#ifdef OPTIHEAP_THREAD_SAFE
+#include <pthread.h>
+#endif
 #ifdef OPTIHEAP_REFERENCE_COUNTING
 #include "reference_counting.h"
 #endif
 
 /*
  * This file implements the optiheap allocator, which is a memory allocator
- * that optimizes memory usage by combining mmap and heap allocation strategies.
- * It uses mmap for large allocations and a heap allocator for smaller ones.
+ * that optimizes memory usage by combining slab, heap and mmap allocation strategies.
+ * It uses slabs for small objects, mmap for large allocations and a heap allocator for the rest.
+ * The heap/mmap cut-over is mmap_threshold, which adapts to the workload (see mmap_allocator.c).
  * 
- * It mainly works as an orchestrator between the mmap allocator and the heap allocator,
+ * It mainly works as an orchestrator between the slab, mmap and heap allocators,
  * delegating allocation and deallocation tasks to the appropriate allocator based on
  * the size of the requested memory block.
  */
 
-#define MAX_HEAP_ALLOC_SIZE (1024 * 128) // Define a threshold for heap allocation size
-
 static int setup_done = 0;
 
+#ifdef OPTIHEAP_THREAD_SAFE
+/*
+ * This function runs before fork() and takes every allocator lock, so that the child never
+ * inherits a lock held by a thread that does not exist on its side of the fork.
+ * Slab class mutexes are taken before slab_mutex, as the slab allocator nests them that way,
+ * and the heap's size group locks before its segment list lock.
+ */
+static void optiheap_prepare_fork(void)
+{
+    for (size_t i = 0; i < SLAB_NUM_CLASSES; i++) {
+        adaptive_lock_acquire(&slab_list.classes[i].mutex);
+    }
+    adaptive_lock_acquire(&slab_mutex);
+    heap_lock_all();
+    adaptive_lock_acquire(&mmap_mutex);
+}
+
+
+/*
+ * This function runs after fork() in both the parent and the child and releases the locks
+ * taken by optiheap_prepare_fork. The forking thread owns them on both sides.
+ */
+static void optiheap_release_fork(void)
+{
+    adaptive_lock_release(&mmap_mutex);
+    heap_unlock_all();
+    adaptive_lock_release(&slab_mutex);
+    for (size_t i = SLAB_NUM_CLASSES; i-- > 0;) {
+        adaptive_lock_release(&slab_list.classes[i].mutex);
+    }
+}
+#endif
+
 void optiheap_allocator_init()
 {
-    #ifdef OPTIHEAP_DEBUGGER
-    printf("Warning: Optiheap Debugger is enabled.\n");
-    #endif
     mmap_allocator_init();
     heap_allocator_init();
+    slab_allocator_init();
     setup_done = 1; // Ensure initialization is done only once
+
+    // Anything below may allocate through an interposed malloc, which must find the allocator ready
+    #ifdef OPTIHEAP_THREAD_SAFE
+    static int fork_handlers_registered = 0;
+    if (!fork_handlers_registered) {
+        pthread_atfork(optiheap_prepare_fork, optiheap_release_fork, optiheap_release_fork);
+        fork_handlers_registered = 1;
+    }
+    #endif
+    #ifdef OPTIHEAP_DEBUGGER
+    printf("Warning: Optiheap Debugger is enabled.\n");
+    #endif
 }
 
 void* optiheap_allocate(size_t size)
@@ -39,20 +93,171 @@ void* optiheap_allocate(size_t size)
         return NULL; // No allocation for zero size
     }
 
-    if (size > MAX_HEAP_ALLOC_SIZE) {
+    #ifdef OPTIHEAP_THREAD_SAFE
+    if (size <= mmap_threshold) {
+        void *cached = thread_cache_allocate(size); // lock-free for cached sizes
+        if (cached) {
+            return cached;
+        }
+    }
+    #endif
+
+    if (size <= SLAB_MAX_SIZE) {
+        void *slot = allocate_slab_block(size); //  for small objects
+        if (slot != ALLOCATION_FAILED) {
+            return slot;
+        }
+        // The slab region is exhausted, the heap can still serve the request
+    }
+
+    if (size > mmap_threshold) {
         return allocate_mmap_block(size); //  for large allocations
     } else {
         return allocate_heap_block(size); //  for smaller allocations
     }
 }
 
+/*
+ * This function allocates zero-initialised memory for an array of nmemb elements of size bytes.
+ * Memory that is known to come straight from the kernel is not cleared again: fresh mappings
+ * and heap blocks carved from freshly committed segment pages are already zero,
+ * so large zeroed allocations only cost their page faults. Recycled memory is cleared.
+ * returns NULL if the total size is 0
+ * returns ALLOCATION_FAILED if nmemb * size overflows or no memory is available
+ */
+void* optiheap_calloc(size_t nmemb, size_t size)
+{
+    if (!setup_done) {
+        optiheap_allocator_init();
+    }
+
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        fprintf(stderr, "Error: Allocation of %zu elements of %zu bytes overflows size_t\n", nmemb, size);
+        return ALLOCATION_FAILED;
+    }
+    size_t total = nmemb * size;
+    if (total == 0) {
+        return NULL; // No allocation for zero size
+    }
+
+    if (total > mmap_threshold) {
+        return allocate_mmap_block_zeroed(total); // Only recycled mappings are cleared
+    }
+
+    void *ptr = NULL;
+    #ifdef OPTIHEAP_THREAD_SAFE
+    ptr = thread_cache_allocate(total); // cached blocks are always recycled
+    #endif
+    if (!ptr && total <= SLAB_MAX_SIZE) {
+        ptr = allocate_slab_block(total);
+        if (ptr == ALLOCATION_FAILED) {
+            ptr = NULL; // The slab region is exhausted, the heap can still serve the request
+        }
+    }
+    if (ptr) {
+        memset(ptr, 0, total);
+        return ptr;
+    }
+    return allocate_heap_block_zeroed(total);
+}
+
+/*
+ * This function allocates size bytes like optiheap_allocate, with flags from enum optiheap_allocate_flag.
+ * OPTIHEAP_ALLOCATE_POPULATE faults the block's pages in before it is returned, so a large block
+ * fresh from the kernel takes all its page faults here, in one madvise call, instead of
+ * one by one at its first use.
+ * returns NULL if size is 0
+ * returns ALLOCATION_FAILED if no memory is available
+ */
+void* optiheap_allocate_flags(size_t size, unsigned int flags)
+{
+    void *ptr = (flags & OPTIHEAP_ALLOCATE_ZERO) ? optiheap_calloc(1, size) : optiheap_allocate(size);
+    if (ptr && ptr != ALLOCATION_FAILED && (flags & OPTIHEAP_ALLOCATE_POPULATE)) {
+        prefault_pages(ptr, size);
+    }
+    return ptr;
+}
+
+/*
+ * This function allocates size bytes whose address is a multiple of alignment, which must be a power of two.
+ * Small requests use a slab class whose slots are naturally aligned, heap requests split the
+ * padding in front of the aligned payload back into the free lists, and mmap requests unmap it,
+ * so the block can be released with optiheap_free like any other.
+ * returns NULL if size is 0
+ * returns ALLOCATION_FAILED if alignment is invalid or no memory is available
+ */
+void* optiheap_aligned_allocate(size_t alignment, size_t size)
+{
+    if (!setup_done) {
+        optiheap_allocator_init();
+    }
+
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        fprintf(stderr, "Error: Alignment %zu is not a power of two\n", alignment);
+        return ALLOCATION_FAILED;
+    }
+    if (size == 0) {
+        return NULL; // No allocation for zero size
+    }
+    if (alignment <= HEAP_ALIGNMENT) {
+        return optiheap_allocate(size); // Every tier already aligns this far
+    }
+
+    // Slots start on a cache line, so a class whose slot size is a multiple of alignment keeps every slot aligned
+    size_t rounded = (size + alignment - 1) & ~(alignment - 1); // Wraps for huge sizes, which the size check rules out
+    if (alignment <= SLAB_SLOT_ALIGNMENT && size <= SLAB_MAX_SIZE && rounded <= SLAB_MAX_SIZE &&
+        slab_list.classes[get_slab_class(rounded)].slot_size % alignment == 0) {
+        void *slot = NULL;
+        #ifdef OPTIHEAP_THREAD_SAFE
+        slot = thread_cache_allocate(rounded);
+        #endif
+        if (!slot) {
+            slot = allocate_slab_block(rounded);
+        }
+        if (slot != ALLOCATION_FAILED) {
+            return slot;
+        }
+    }
+
+    if (size <= mmap_threshold && alignment <= mmap_threshold - size) {
+        return allocate_heap_block_aligned(alignment, size);
+    }
+    return allocate_mmap_block_aligned(alignment, size);
+}
+
+
+/*
+ * This function follows posix_memalign: alignment must be a power of two multiple of sizeof(void *).
+ * It returns 0 and stores the block in *memptr on success (NULL for a zero size),
+ * EINVAL for an invalid alignment or ENOMEM if no memory is available, leaving *memptr untouched.
+ */
+int optiheap_posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0 || alignment == 0) {
+        return EINVAL;
+    }
+    void *ptr = optiheap_aligned_allocate(alignment, size);
+    if (ptr == ALLOCATION_FAILED) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
 void* optiheap_reference_allocate([[maybe_unused]]size_t size, [[maybe_unused]]void (*destructor)(void *))
 {
     #ifdef OPTIHEAP_REFERENCE_COUNTING
-    void* ptr = optiheap_allocate(size);
-    if (ptr) {
-        optiheap_retain(ptr); // Retain the pointer to manage reference counting
-        optiheap_set_destructor(ptr, destructor); // Set the destructor for the pointer
+    if (!setup_done) {
+        optiheap_allocator_init();
+    }
+    if (size == 0) {
+        return NULL;
+    }
+
+    // Slab objects carry no header to hold the reference count, so bypass the slab allocator
+    void* ptr = size > mmap_threshold ? allocate_mmap_block(size) : allocate_heap_block(size);
+    if (ptr != ALLOCATION_FAILED) {
+        optiheap_reference_init(ptr, destructor); // One reference held by the caller, recycled headers are not cleared
     }
     return ptr; // Return the allocated pointer
     #else
@@ -61,19 +266,487 @@ void* optiheap_reference_allocate([[maybe_unused]]size_t size, [[maybe_unused]]v
     #endif
 }
 
+/*
+ * This function frees a block that is not a slab object.
+ * The page map tells heap pages from mmap blocks in constant time and without a lock.
+ * Blocks of the calling thread's arena are the common case, so a single lookup finds them
+ * and they go straight to the thread cache. Blocks of other arenas are queued on their owner
+ * by free_heap_block. These checks do not ensure that the pointer is an allocated heap block,
+ * which free_heap_block validates, and free_mmap_block rejects pointers it does not own.
+ */
+static void* free_heap_or_mmap_block(void *ptr)
+{
+    if (heap_block_is_local((struct memory_header *)ptr - 1)) {
+        #ifdef OPTIHEAP_THREAD_SAFE
+        if (thread_cache_free(ptr)) {
+            return NULL; // parked in the calling thread's cache
+        }
+        #endif
+        return free_heap_block(ptr);
+    }
+    if (within_heap_range(ptr)) {
+        return free_heap_block(ptr);
+    }
+    return free_mmap_block(ptr);
+}
+
 void* optiheap_free(void* ptr)
 {
     if (!ptr) {
         return NULL; // No action for null pointer
     } 
 
-    // This check does not ensure that the pointer is allocated in heap,
-    // but it assures that it is not allocated using mmap.
-    // Note: A early check and later action continues to remain thread safe,
-    // because the heap doesn't shrink at any point in time.
-    if(within_heap_range(ptr)) {
-        return free_heap_block(ptr);
-    } else {
-        return free_mmap_block(ptr);
+    if (within_slab_range(ptr)) {
+        #ifdef OPTIHEAP_THREAD_SAFE
+        if (thread_cache_free_slab(ptr)) {
+            return NULL; // parked in the calling thread's cache
+        }
+        #endif
+        return free_slab_block(ptr);
+    }
+
+    return free_heap_or_mmap_block(ptr);
+}
+
+
+/*
+ * This function frees a block the caller knows the size of, as C++ sized delete and containers do.
+ * size must be the size the block was allocated with, or anything up to its usable size.
+ * The size says which tier to look at first: a block above the mmap threshold is looked up
+ * as a mapping before the heap is probed, and slab-sized blocks skip the heap and mmap
+ * lookups altogether when they lie in the slab region. Debug builds check size against the
+ * usable size of the block.
+ * returns NULL if deallocation is successful
+ * returns DEALLOCATION_FAILED if the pointer is invalid or, in debug builds, size does not fit the block
+ */
+void* optiheap_free_sized(void *ptr, size_t size)
+{
+    if (!ptr) {
+        return NULL; // No action for null pointer
     }
-}
\ No newline at end of file
+
+    #ifdef OPTIHEAP_DEBUGGER
+    size_t usable = optiheap_usable_size(ptr);
+    if (size > usable) {
+        fprintf(stderr, "Error: Size %zu passed to optiheap_free_sized exceeds the %zu usable bytes of pointer %p\n", size, usable, ptr);
+        return DEALLOCATION_FAILED;
+    }
+    #endif
+
+    if (size <= SLAB_MAX_SIZE || within_slab_range(ptr)) {
+        return optiheap_free(ptr); // Slab objects are found by a range check, heap-served small blocks fall through to it
+    }
+    if (size > mmap_threshold && is_mmap_block((struct memory_header *)ptr - 1)) {
+        return release_mmap_block(ptr); // Already found in the page map, skip free_mmap_block's lookup
+    }
+    return free_heap_or_mmap_block(ptr);
+}
+
+
+/*
+ * This function allocates count blocks of size bytes into out.
+ * The size class is worked out once and each tier serves the whole batch under one lock
+ * round-trip: slab classes hand out several slots at a time, and the heap carves consecutive
+ * blocks from one free block or segment tail. Sizes above the mmap threshold still get one mapping each.
+ * Batches bypass the thread cache, their blocks can be freed one by one or with optiheap_free_batch.
+ * returns the number of blocks written to out, fewer than count only if memory ran out
+ */
+size_t optiheap_allocate_batch(size_t size, size_t count, void **out)
+{
+    if (!setup_done) {
+        optiheap_allocator_init();
+    }
+
+    if (size == 0) {
+        return 0; // No allocation for zero size
+    }
+
+    size_t allocated = 0;
+    if (size <= SLAB_MAX_SIZE) {
+        allocated = allocate_slab_blocks(get_slab_class(size), out, count);
+    }
+    if (allocated < count && size <= mmap_threshold) {
+        allocated += allocate_heap_blocks(HEAP_ALIGN(size), out + allocated, count - allocated);
+    }
+    while (allocated < count && size > mmap_threshold) {
+        void *ptr = allocate_mmap_block(size);
+        if (ptr == ALLOCATION_FAILED) {
+            break;
+        }
+        out[allocated++] = ptr;
+    }
+    return allocated;
+}
+
+
+// Pointers of one tier gathered on the stack before optiheap_free_batch hands them over
+#define OPTIHEAP_FREE_BATCH_CHUNK 256
+
+/*
+ * This function frees count blocks of any tier, NULL entries are skipped.
+ * Slab and heap pointers are gathered per tier and freed in groups, so each lock is taken once
+ * per group and back-to-back heap blocks are coalesced in a single pass. Other pointers go
+ * through optiheap_free. ptrs itself is left untouched.
+ * returns the number of pointers that could not be freed
+ */
+size_t optiheap_free_batch(void **ptrs, size_t count)
+{
+    void *slab_ptrs[OPTIHEAP_FREE_BATCH_CHUNK];
+    void *heap_ptrs[OPTIHEAP_FREE_BATCH_CHUNK];
+    size_t slab_count = 0, heap_count = 0, failed = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        void *ptr = ptrs[i];
+        if (!ptr) {
+            continue;
+        }
+        if (within_slab_range(ptr)) {
+            slab_ptrs[slab_count++] = ptr;
+            if (slab_count == OPTIHEAP_FREE_BATCH_CHUNK) {
+                failed += free_slab_blocks(slab_ptrs, slab_count);
+                slab_count = 0;
+            }
+        } else if (within_heap_range(ptr)) {
+            heap_ptrs[heap_count++] = ptr;
+            if (heap_count == OPTIHEAP_FREE_BATCH_CHUNK) {
+                failed += free_heap_blocks(heap_ptrs, heap_count);
+                heap_count = 0;
+            }
+        } else if (free_mmap_block(ptr) != NULL) {
+            failed++;
+        }
+    }
+
+    failed += free_slab_blocks(slab_ptrs, slab_count);
+    failed += free_heap_blocks(heap_ptrs, heap_count);
+    return failed;
+}
+
+
+/*
+ * This function moves a block to a freshly allocated one of size bytes.
+ * The first old_size bytes (or fewer if the new block is smaller) are copied over.
+ * The old block is only freed once the copy succeeded, so on failure it is left intact.
+ */
+static void* move_allocation(void *ptr, size_t old_size, size_t size)
+{
+    void *new_ptr = optiheap_allocate(size);
+    if (new_ptr == ALLOCATION_FAILED) {
+        return ALLOCATION_FAILED;
+    }
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    optiheap_free(ptr);
+    return new_ptr;
+}
+
+
+/*
+ * This function resizes a block to hold at least size bytes, preserving its contents.
+ * It avoids copying whenever it can: slab slots are kept if the new size still fits the slot,
+ * heap blocks shrink by splitting and grow into a free neighbour or the heap's untouched tail,
+ * and mmap blocks are resized with mremap which remaps pages instead of copying them.
+ * A block only moves tiers (and is copied) when the new size belongs to a different one.
+ * returns NULL if ptr was freed because size is 0
+ * returns the new pointer on success, which may equal ptr
+ * returns ALLOCATION_FAILED if ptr is invalid or no memory is available, ptr is then left untouched
+ */
+void* optiheap_reallocate(void *ptr, size_t size)
+{
+    if (!ptr) {
+        return optiheap_allocate(size);
+    }
+    if (size == 0) {
+        optiheap_free(ptr);
+        return NULL;
+    }
+
+    if (within_slab_range(ptr)) {
+        if (!is_slab_block(ptr)) {
+            fprintf(stderr, "Error: Attempt to reallocate invalid pointer %p\n", ptr);
+            return ALLOCATION_FAILED;
+        }
+        size_t slot_size = slab_block_size(ptr);
+        if (size <= slot_size && size > slot_size / 2) {
+            return ptr; // Still a good fit for its size class
+        }
+        return move_allocation(ptr, slot_size, size);
+    }
+
+    struct memory_header *header = ((struct memory_header *)ptr) - 1;
+
+    if (within_heap_range(ptr)) {
+        if (size <= mmap_threshold && size > SLAB_MAX_SIZE) {
+            void *resized = reallocate_heap_block(ptr, size);
+            if (resized) {
+                return resized; // Resized in place, or ALLOCATION_FAILED for an invalid pointer
+            }
+        } else if (header->magic != HEAP_ALLOCATED) {
+            fprintf(stderr, "Error: Attempt to reallocate invalid or corrupted pointer %p\n", ptr);
+            return ALLOCATION_FAILED;
+        }
+        return move_allocation(ptr, BLOCK_SIZE(header), size);
+    }
+
+    if (size > mmap_threshold) {
+        void *resized = reallocate_mmap_block(ptr, size);
+        if (resized) {
+            return resized; // Remapped, or ALLOCATION_FAILED for an invalid pointer
+        }
+    } else if (!is_mmap_block(header) || header->magic != MMAP_ALLOCATED) {
+        // The page map is asked first, the header of a foreign or unmapped pointer may not be readable
+        fprintf(stderr, "Error: Attempt to reallocate invalid or corrupted pointer %p\n", ptr);
+        return ALLOCATION_FAILED;
+    }
+    return move_allocation(ptr, header->size, size);
+}
+
+
+/*
+ * This function returns the number of bytes that can actually be used in a block,
+ * which may be larger than the size it was allocated with.
+ * It returns 0 for NULL or for a pointer that is not an allocated block.
+ */
+size_t optiheap_usable_size(void *ptr)
+{
+    if (!ptr) {
+        return 0;
+    }
+    if (within_slab_range(ptr)) {
+        return is_slab_block(ptr) ? slab_block_size(ptr) : 0;
+    }
+
+    struct memory_header *header = ((struct memory_header *)ptr) - 1;
+    if (within_heap_range(ptr)) {
+        return header->magic == HEAP_ALLOCATED ? BLOCK_SIZE(header) : 0;
+    }
+    // The page map is asked first, the header of a foreign or unmapped pointer may not be readable
+    return is_mmap_block(header) && header->magic == MMAP_ALLOCATED ? header->size : 0;
+}
+
+
+/*
+ * This function returns free memory to the OS, like glibc's malloc_trim.
+ * The calling thread's cache is flushed, the interior pages of every free heap block are
+ * released with madvise, the tail of every heap segment is decommitted down to pad bytes
+ * and the mappings parked in the mmap cache are unmapped.
+ * Other threads' caches are flushed when they exit.
+ * It returns 1 if any memory was released, otherwise returns 0.
+ */
+int optiheap_trim(size_t pad)
+{
+    if (!setup_done) {
+        return 0;
+    }
+    #ifdef OPTIHEAP_THREAD_SAFE
+    thread_cache_flush();
+    #endif
+    int released = heap_trim(pad);
+    released |= mmap_cache_release();
+    return released;
+}
+
+/*
+ * This function commits and faults in bytes of memory for objects of object_size bytes, so that
+ * the objects carved from it afterwards take no page fault on first touch. Slab sizes get enough
+ * empty slabs for bytes worth of slots, heap sizes get bytes of segment tail in the size group of
+ * the calling thread's arena that serves object_size, where no other size can use it.
+ * Nothing is carved into blocks: free lists and thread caches are left as they are.
+ * The heap memory stays reserved until it is allocated or the heap is trimmed.
+ * Sizes above the mmap threshold get a mapping each when allocated, nothing is reserved for them.
+ * It returns 0 on success, or -1 if the memory could not be reserved.
+ */
+int optiheap_reserve(size_t bytes, size_t object_size)
+{
+    if (!setup_done) {
+        optiheap_allocator_init();
+    }
+    if (bytes == 0 || object_size == 0 || object_size > mmap_threshold) {
+        return 0;
+    }
+    if (object_size <= SLAB_MAX_SIZE) {
+        size_t size_class = get_slab_class(object_size);
+        return slab_reserve(size_class, bytes / slab_list.classes[size_class].slot_size);
+    }
+    return heap_reserve(heap_size_group(HEAP_ALIGN(object_size)), bytes);
+}
+
+/*
+ * This function prepares the allocator for the objects the calling thread is about to allocate,
+ * given as count classes of object size and number of objects live at once.
+ * Slab classes get enough faulted-in empty slabs to hold their objects, and heap sizes
+ * are added up, headers included, into one reservation per heap size group.
+ * Warm-up only commits and faults in memory: no block is carved in advance, so the free lists
+ * and the thread caches fill as the objects are allocated, from memory that is already resident.
+ * Sizes above the mmap threshold get a mapping each when allocated, nothing can be prepared
+ * for them; optiheap_allocate_flags with OPTIHEAP_ALLOCATE_POPULATE faults them in up front.
+ * It returns 0 on success, or -1 if some of the memory could not be reserved.
+ */
+int optiheap_warmup(const struct optiheap_warmup_class *classes, size_t count)
+{
+    if (!setup_done) {
+        optiheap_allocator_init();
+    }
+
+    int result = 0;
+    size_t heap_bytes[HEAP_SIZE_GROUPS] = {0};
+    for (size_t i = 0; i < count; i++) {
+        size_t size = classes[i].size;
+        if (size == 0 || classes[i].count == 0 || size > mmap_threshold) {
+            continue;
+        }
+        if (size <= SLAB_MAX_SIZE) {
+            if (slab_reserve(get_slab_class(size), classes[i].count) != 0) {
+                result = -1;
+            }
+            continue;
+        }
+        size_t group = heap_size_group(HEAP_ALIGN(size));
+        size_t block_size = HEAP_ALIGN(size) + sizeof(struct memory_header);
+        if (classes[i].count > (SIZE_MAX - heap_bytes[group]) / block_size) {
+            fprintf(stderr, "Error: Warm-up of %zu objects of %zu bytes overflows size_t\n", classes[i].count, size);
+            return -1;
+        }
+        heap_bytes[group] += classes[i].count * block_size;
+    }
+    for (size_t group = 0; group < HEAP_SIZE_GROUPS; group++) {
+        if (heap_bytes[group] && heap_reserve(group, heap_bytes[group]) != 0) {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+/*
+ * This function changes a runtime tunable of the allocator.
+ * It returns 0 on success, or -1 if the option is unknown, unsupported in this build or the value is invalid.
+ */
+int optiheap_set_option(enum optiheap_option option, [[maybe_unused]]size_t value)
+{
+    switch (option) {
+    case OPTIHEAP_OPTION_THREAD_CACHE_DEPTH:
+        #ifdef OPTIHEAP_THREAD_SAFE
+        return thread_cache_set_depth(value);
+        #else
+        fprintf(stderr, "Error: Thread caches are only available with -DOPTIHEAP_THREAD_SAFE.\n");
+        return -1;
+        #endif
+    case OPTIHEAP_OPTION_MMAP_THRESHOLD:
+        mmap_threshold_set(value);
+        return 0;
+    case OPTIHEAP_OPTION_MMAP_THRESHOLD_MAX:
+        mmap_threshold_set_max(value);
+        return 0;
+    case OPTIHEAP_OPTION_HEAP_TRIM_THRESHOLD:
+        heap_set_trim_threshold(value);
+        return 0;
+    case OPTIHEAP_OPTION_HEAP_RELEASE_THRESHOLD:
+        heap_set_release_threshold(value);
+        return 0;
+    case OPTIHEAP_OPTION_MMAP_CACHE_LIMIT:
+        mmap_cache_set_limit(value);
+        return 0;
+    case OPTIHEAP_OPTION_MMAP_CACHE_DECAY_MS:
+        mmap_cache_set_decay(value);
+        return 0;
+    case OPTIHEAP_OPTION_ARENA_COUNT:
+        return heap_set_arena_count(value);
+    case OPTIHEAP_OPTION_HUGE_PAGES:
+        if (value > OPTIHEAP_HUGE_PAGES_EXPLICIT) {
+            fprintf(stderr, "Error: Unknown huge page mode %zu\n", value);
+            return -1;
+        }
+        huge_page_mode = (int)value;
+        return 0;
+    }
+    fprintf(stderr, "Error: Unknown OptiHeap option %d\n", (int)option);
+    return -1;
+}
+
+
+/*
+ * This function reads the current value of a runtime tunable, or 0 if it is unknown or unsupported.
+ */
+size_t optiheap_get_option(enum optiheap_option option)
+{
+    switch (option) {
+    case OPTIHEAP_OPTION_THREAD_CACHE_DEPTH:
+        #ifdef OPTIHEAP_THREAD_SAFE
+        return thread_cache_get_depth();
+        #else
+        return 0;
+        #endif
+    case OPTIHEAP_OPTION_MMAP_THRESHOLD:
+        return mmap_threshold;
+    case OPTIHEAP_OPTION_MMAP_THRESHOLD_MAX:
+        return mmap_threshold_get_max();
+    case OPTIHEAP_OPTION_HEAP_TRIM_THRESHOLD:
+        return heap_get_trim_threshold();
+    case OPTIHEAP_OPTION_HEAP_RELEASE_THRESHOLD:
+        return heap_get_release_threshold();
+    case OPTIHEAP_OPTION_MMAP_CACHE_LIMIT:
+        return mmap_cache_get_limit();
+    case OPTIHEAP_OPTION_MMAP_CACHE_DECAY_MS:
+        return mmap_cache_get_decay();
+    case OPTIHEAP_OPTION_ARENA_COUNT:
+        return heap_get_arena_count();
+    case OPTIHEAP_OPTION_HUGE_PAGES:
+        return (size_t)huge_page_mode;
+    }
+    return 0;
+}
+
+
+/*
+ * This function fills stats with a snapshot of heap arena index.
+ * Arenas that no thread was assigned to yet report zeros.
+ * It returns 0 on success, or -1 if index is not below OPTIHEAP_HEAP_MAX_ARENAS or stats is NULL.
+ */
+int optiheap_get_arena_stats(size_t index, struct optiheap_arena_stats *stats)
+{
+    if (!stats || !setup_done) {
+        return -1;
+    }
+    return heap_get_arena_stats(index, stats);
+}
+
+
+/*
+ * This function fills stats with the memory each tier placed on huge pages.
+ * The advised and hugetlbfs counts are kept by the allocator, the bytes actually backed by
+ * transparent huge pages are read from /proc/self/smaps, so this call is meant for monitoring
+ * rather than hot paths. Slabs are never placed on huge pages.
+ * It returns 0 on success, or -1 if stats is NULL.
+ */
+int optiheap_get_huge_page_stats(struct optiheap_huge_page_stats *stats)
+{
+    if (!stats) {
+        return -1;
+    }
+    if (!setup_done) {
+        optiheap_allocator_init();
+    }
+    size_t mmap_transparent_bytes;
+    stats->heap_advised_bytes = heap_huge_page_bytes();
+    mmap_huge_page_bytes(&stats->mmap_advised_bytes, &stats->mmap_hugetlb_bytes);
+    huge_page_measure(&stats->heap_huge_bytes, &mmap_transparent_bytes);
+    stats->mmap_huge_bytes = stats->mmap_hugetlb_bytes + mmap_transparent_bytes;
+    return 0;
+}
+
+
+/*
+ * This function fills stats with the contention seen by the allocator's locks, summed over all of them.
+ * Only builds with both OPTIHEAP_THREAD_SAFE and OPTIHEAP_LOCK_STATS keep the counters.
+ * It returns 0 on success, or -1 if stats is NULL or the counters are not compiled in.
+ */
+int optiheap_get_lock_stats(struct optiheap_lock_stats *stats)
+{
+    if (!stats) {
+        return -1;
+    }
+    #ifdef OPTIHEAP_THREAD_SAFE
+    return adaptive_lock_get_stats(stats);
+    #else
+    return -1;
+    #endif
+}
@@ -0,0 +1,145 @@
+#define _DEFAULT_SOURCE // sysconf is not part of strict C99
+#include "memory_structs.h"
+#include "heap_allocator.h"
+#include "../include/optiheap_allocator.h"
+
+/*
+ * This file exports the standard malloc family on top of OptiHeap, so that unmodified
+ * programs can run on it with LD_PRELOAD=lib/liboptiheap_preload.so.
+ * It is only compiled in by `make preload`, which defines OPTIHEAP_PRELOAD and always
+ * enables OPTIHEAP_THREAD_SAFE, the regular libraries never interpose malloc.
+ *
+ * Early-process bootstrap: the dynamic loader and libc start calling malloc before any
+ * constructor runs, so the allocator initialises itself lazily on the first call and
+ * nothing on that path allocates through malloc again.
+ * Fork: optiheap_allocator_init registers pthread_atfork handlers that hold every allocator
+ * lock across fork(), so a child never inherits a lock owned by a thread that is gone.
+ *
+ * The C library reports failures with NULL and errno instead of ALLOCATION_FAILED,
+ * and expects malloc(0) to return a unique pointer that can be freed.
+ */
+
+#ifdef OPTIHEAP_PRELOAD
+
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+
+static void* to_libc_result(void *ptr)
+{
+    if (ptr == ALLOCATION_FAILED) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return ptr;
+}
+
+
+void* malloc(size_t size)
+{
+    return to_libc_result(optiheap_allocate(size ? size : 1));
+}
+
+
+void free(void *ptr)
+{
+    optiheap_free(ptr);
+}
+
+
+/*
+ * C23 sized deallocation, the size lets optiheap_free_sized look in the right tier first.
+ */
+void free_sized(void *ptr, size_t size)
+{
+    optiheap_free_sized(ptr, size);
+}
+
+
+void free_aligned_sized(void *ptr, [[maybe_unused]]size_t alignment, size_t size)
+{
+    optiheap_free_sized(ptr, size);
+}
+
+
+void* calloc(size_t nmemb, size_t size)
+{
+    if (nmemb == 0 || size == 0) {
+        nmemb = size = 1;
+    }
+    return to_libc_result(optiheap_calloc(nmemb, size));
+}
+
+
+/*
+ * realloc(NULL, 0) is malloc(0) and must return a pointer that can be freed, a non-NULL block
+ * resized to 0 is freed and NULL is returned, as glibc does.
+ */
+void* realloc(void *ptr, size_t size)
+{
+    if (!ptr) {
+        return malloc(size);
+    }
+    return to_libc_result(optiheap_reallocate(ptr, size));
+}
+
+
+void* reallocarray(void *ptr, size_t nmemb, size_t size)
+{
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(ptr, nmemb * size);
+}
+
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    return optiheap_posix_memalign(memptr, alignment, size ? size : 1);
+}
+
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return to_libc_result(optiheap_aligned_allocate(alignment, size ? size : 1));
+}
+
+
+/*
+ * memalign accepts any alignment, glibc rounds one that is not a power of two up to the next one.
+ */
+void* memalign(size_t alignment, size_t size)
+{
+    size_t power = HEAP_ALIGNMENT;
+    while (power < alignment && power <= SIZE_MAX / 2) {
+        power <<= 1;
+    }
+    return aligned_alloc(power, size);
+}
+
+
+void* valloc(size_t size)
+{
+    return aligned_alloc((size_t)sysconf(_SC_PAGESIZE), size);
+}
+
+
+void* pvalloc(size_t size)
+{
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t rounded = (size + page_size - 1) & ~(page_size - 1);
+    return aligned_alloc(page_size, rounded ? rounded : page_size);
+}
+
+
+size_t malloc_usable_size(void *ptr)
+{
+    return optiheap_usable_size(ptr);
+}
+
+#endif // OPTIHEAP_PRELOAD
@@ -0,0 +1,118 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS is not part of strict C99
+#include "page_map.h"
+
+#include <sys/mman.h>
+#include <stdio.h>
+
+/*
+ * This file implements the page map declared in page_map.h.
+ * The 36-bit page number is split into three 12-bit indices: the root is a static array,
+ * the inner nodes and the leaves are 32 KiB mappings installed with a compare-and-swap,
+ * so concurrent writers never need a lock and readers never see a half-built node.
+ * Writers only touch the entries of memory they own, so entries need no further ordering
+ * than the release/acquire pairs that publish them.
+ */
+
+#define PAGE_MAP_LEVEL_BITS ((PAGE_MAP_ADDRESS_BITS - PAGE_MAP_SHIFT) / 3)
+#define PAGE_MAP_LEVEL_SIZE ((size_t)1 << PAGE_MAP_LEVEL_BITS)
+#define PAGE_MAP_LEVEL_MASK (PAGE_MAP_LEVEL_SIZE - 1)
+
+static void *page_map_root[PAGE_MAP_LEVEL_SIZE]; // Inner nodes, each an array of PAGE_MAP_LEVEL_SIZE leaves
+
+
+/*
+ * This function returns the node stored in slot, creating and installing a zeroed one if it is empty.
+ * It returns NULL if the node could not be mapped.
+ */
+static void* page_map_node(void **slot)
+{
+    void *node = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (node) {
+        return node;
+    }
+
+    size_t size = PAGE_MAP_LEVEL_SIZE * sizeof(void *);
+    void *fresh = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (fresh == MAP_FAILED) {
+        fprintf(stderr, "Error: mmap failed to allocate %zu bytes for the page map\n", size);
+        return NULL;
+    }
+    if (__atomic_compare_exchange_n(slot, &node, fresh, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return fresh;
+    }
+    munmap(fresh, size); // Another thread installed the node first
+    return node;
+}
+
+
+/*
+ * This function returns the entry slot of a page number, or NULL if the page is beyond the map
+ * or its leaf does not exist and create is not set.
+ */
+static uintptr_t* page_map_slot(uintptr_t page, int create)
+{
+    if (page >> (3 * PAGE_MAP_LEVEL_BITS)) {
+        return NULL;
+    }
+    void **root_slot = &page_map_root[page >> (2 * PAGE_MAP_LEVEL_BITS)];
+    void **node = create ? page_map_node(root_slot) : __atomic_load_n(root_slot, __ATOMIC_ACQUIRE);
+    if (!node) {
+        return NULL;
+    }
+    void **leaf_slot = &node[(page >> PAGE_MAP_LEVEL_BITS) & PAGE_MAP_LEVEL_MASK];
+    uintptr_t *leaf = create ? page_map_node(leaf_slot) : __atomic_load_n(leaf_slot, __ATOMIC_ACQUIRE);
+    if (!leaf) {
+        return NULL;
+    }
+    return &leaf[page & PAGE_MAP_LEVEL_MASK];
+}
+
+
+/*
+ * This function records owner and kind for every page overlapping [start, start + length).
+ * It returns 0 on success, or -1 if a page lies beyond the map or a node could not be created,
+ * in which case the pages it already recorded are forgotten again.
+ */
+int page_map_set(void *start, size_t length, void *owner, uintptr_t kind)
+{
+    uintptr_t entry = (uintptr_t)owner | kind;
+    uintptr_t first = (uintptr_t)start >> PAGE_MAP_SHIFT;
+    uintptr_t last = ((uintptr_t)start + (length ? length : 1) - 1) >> PAGE_MAP_SHIFT;
+    for (uintptr_t page = first; page <= last; page++) {
+        uintptr_t *slot = page_map_slot(page, 1);
+        if (!slot) {
+            if (page > first) {
+                page_map_clear(start, (size_t)((page << PAGE_MAP_SHIFT) - (uintptr_t)start));
+            }
+            return -1;
+        }
+        __atomic_store_n(slot, entry, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+
+/*
+ * This function forgets the owner of every page overlapping [start, start + length).
+ */
+void page_map_clear(void *start, size_t length)
+{
+    uintptr_t first = (uintptr_t)start >> PAGE_MAP_SHIFT;
+    uintptr_t last = ((uintptr_t)start + (length ? length : 1) - 1) >> PAGE_MAP_SHIFT;
+    for (uintptr_t page = first; page <= last; page++) {
+        uintptr_t *slot = page_map_slot(page, 0);
+        if (slot) {
+            __atomic_store_n(slot, 0, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+
+/*
+ * This function returns the entry of the page holding ptr, or 0 if the page has no owner.
+ */
+uintptr_t page_map_get(void *ptr)
+{
+    uintptr_t *slot = page_map_slot((uintptr_t)ptr >> PAGE_MAP_SHIFT, 0);
+    return slot ? __atomic_load_n(slot, __ATOMIC_ACQUIRE) : 0;
+}
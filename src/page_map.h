@@ -0,0 +1,27 @@
+#ifndef PAGE_MAP_H
+#define PAGE_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The page map is a three-level radix tree from the number of a 4 KiB page to the owner of that page.
+ * An entry is the owner's address with its kind in the low bits: heap pages point to their segment,
+ * the page holding an mmap block's header points to that block's mmap header.
+ * Lookups are lock-free and take three dependent loads, nodes are created on demand and never freed.
+ */
+#define PAGE_MAP_SHIFT 12
+#define PAGE_MAP_ADDRESS_BITS 48 // Addresses at or above 2^48 cannot be tracked
+
+#define PAGE_MAP_HEAP ((uintptr_t)1)
+#define PAGE_MAP_MMAP ((uintptr_t)2)
+#define PAGE_MAP_KIND_MASK ((uintptr_t)0xF) // Owners are at least 16-byte aligned
+
+#define PAGE_MAP_KIND(entry) ((entry) & PAGE_MAP_KIND_MASK)
+#define PAGE_MAP_OWNER(entry) ((void *)((entry) & ~PAGE_MAP_KIND_MASK))
+
+int page_map_set(void *start, size_t length, void *owner, uintptr_t kind);
+void page_map_clear(void *start, size_t length);
+uintptr_t page_map_get(void *ptr);
+
+#endif // PAGE_MAP_H
@@ -0,0 +1,44 @@
+#define _GNU_SOURCE // MADV_POPULATE_WRITE is a Linux extension
+#include "prefault.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdint.h>
+
+/*
+ * This file faults memory in ahead of its first use, so that the page faults of fresh memory
+ * are taken at a time of the caller's choosing rather than by the first requests that touch it.
+ */
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23 // Linux 5.14, older headers lack it
+#endif
+
+
+/*
+ * This function makes the pages under [start, start + length) resident and writable, without
+ * changing their contents. The range must be mapped read/write.
+ * MADV_POPULATE_WRITE faults the whole range in one call; kernels without it get every page
+ * written once instead, only ever inside the range, so memory around it may be in use by others.
+ */
+void prefault_pages(void *start, size_t length)
+{
+    static size_t page_size = 0;
+    if (length == 0) {
+        return;
+    }
+    if (!page_size) {
+        page_size = (size_t)sysconf(_SC_PAGESIZE);
+    }
+
+    uintptr_t first = (uintptr_t)start & ~(uintptr_t)(page_size - 1);
+    uintptr_t last = ((uintptr_t)start + length + page_size - 1) & ~(uintptr_t)(page_size - 1);
+    if (madvise((void *)first, last - first, MADV_POPULATE_WRITE) == 0) {
+        return;
+    }
+
+    char *end = (char *)start + length;
+    for (volatile char *byte = start; (char *)byte < end; byte = (char *)(((uintptr_t)byte | (page_size - 1)) + 1)) {
+        *byte = *byte; // Write fault without a change
+    }
+}
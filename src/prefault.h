@@ -0,0 +1,8 @@
+#ifndef PREFAULT_H
+#define PREFAULT_H
+
+#include <stddef.h>
+
+void prefault_pages(void *start, size_t length);
+
+#endif // PREFAULT_H
@@ -7,33 +7,252 @@
 #include <pthread.h>
 
 /*
- * This function locks the appropriate mutex based on the type of memory block (heap or mmap).
- * It returns a pointer to the mutex that was locked.
+ * Reference counts are updated with atomic read-modify-write operations, so retaining and
+ * releasing never take an allocator lock. A lock is only taken by the free routines once the
+ * count drops to zero.
+ *
+ * With OPTIHEAP_BIASED_REFERENCE_COUNTING a block is biased towards the thread that allocated it:
+ * the owner counts its references in ref_biased with plain loads and stores, while every other
+ * thread atomically updates the shared count kept in ref_count above two state bits.
+ * When the owner's count drops to zero it merges the two counts, and the block is freed once the
+ * merged count reaches zero. A thread that drives the unmerged shared count below zero has
+ * released references the owner still counts, so it queues the block on the owner, which merges
+ * it on its next reference counting call. Owners are slots rather than threads: the slot of an
+ * exited thread is adopted by the next thread that needs one, and until then any thread queueing
+ * a block on it merges the queue itself.
  */
-pthread_mutex_t * optiheap_lock([[maybe_unused]]struct memory_header *block)
+#ifdef OPTIHEAP_BIASED_REFERENCE_COUNTING
+#define REF_MERGED ((size_t)1) // The owner's count was merged, only the shared count is left
+#define REF_QUEUED ((size_t)2) // The block waits in its owner's merge queue
+#define REF_SHARED_SHIFT 2
+#define REF_SHARED_ONE ((size_t)1 << REF_SHARED_SHIFT)
+#define REF_SHARED(word) ((intptr_t)(word) >> REF_SHARED_SHIFT) // The shared count may be negative before a merge
+
+#ifndef OPTIHEAP_REF_MAX_OWNERS
+#define OPTIHEAP_REF_MAX_OWNERS 1024
+#endif
+#define REF_NO_OWNER UINT32_MAX // Threads without a slot count every reference atomically
+
+enum { REF_OWNER_ALIVE = 1, REF_OWNER_ORPHANED, REF_OWNER_DRAINING };
+
+struct ref_owner {
+    struct memory_header *queue; // Blocks other threads queued for merging
+    int state; // Whether a live thread holds the slot
+};
+
+static struct ref_owner ref_owners[OPTIHEAP_REF_MAX_OWNERS]; // Slot 0 stands for no owner
+static uint32_t ref_owner_count = 1; // Slots handed out so far
+static __thread uint32_t ref_self; // Slot of the calling thread, 0 until its first reference counting call
+static pthread_key_t ref_owner_key;
+static pthread_once_t ref_owner_once = PTHREAD_ONCE_INIT;
+
+static void ref_merge(struct memory_header *block);
+
+
+/*
+ * This function merges every block queued on an owner slot.
+ * The caller must hold the slot, either as its thread or by draining an orphaned slot.
+ */
+static void ref_drain(uint32_t slot)
+{
+    struct memory_header *block = __atomic_exchange_n(&ref_owners[slot].queue, NULL, __ATOMIC_ACQUIRE);
+    while (block) {
+        struct memory_header *next = block->ref_next; // The merge may free the block
+        ref_merge(block);
+        block = next;
+    }
+}
+
+
+/*
+ * This function drains the queue of an orphaned slot until it stays empty.
+ * Whoever changes the queue or the state checks the other afterwards, so a block queued while
+ * the owner exits is always merged by one of them.
+ */
+static void ref_help_orphan(uint32_t slot)
+{
+    struct ref_owner *owner = &ref_owners[slot];
+    int expected = REF_OWNER_ORPHANED;
+    while (__atomic_load_n(&owner->queue, __ATOMIC_SEQ_CST) &&
+           __atomic_compare_exchange_n(&owner->state, &expected, REF_OWNER_DRAINING, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        ref_drain(slot);
+        __atomic_store_n(&owner->state, REF_OWNER_ORPHANED, __ATOMIC_SEQ_CST);
+    }
+}
+
+
+/*
+ * This function is the pthread key destructor, it gives up the slot of an exiting thread.
+ * References the thread still counts stay in its blocks and pass to the next holder of the slot.
+ */
+static void ref_owner_destructor(void *arg)
 {
-    pthread_mutex_t *mutex = NULL;
-    #ifdef OPTIHEAP_THREAD_SAFE
+    uint32_t slot = (uint32_t)((struct ref_owner *)arg - ref_owners);
+    ref_self = REF_NO_OWNER;
+    __atomic_store_n(&ref_owners[slot].state, REF_OWNER_ORPHANED, __ATOMIC_SEQ_CST);
+    ref_help_orphan(slot);
+}
+
+
+static void ref_owner_key_create(void)
+{
+    pthread_key_create(&ref_owner_key, ref_owner_destructor);
+}
+
+
+/*
+ * This function gives the calling thread a slot, adopting an orphaned one before handing out a new one.
+ * It returns the slot, or REF_NO_OWNER if every slot is taken.
+ */
+static uint32_t ref_claim_owner(void)
+{
+    pthread_once(&ref_owner_once, ref_owner_key_create);
+
+    uint32_t count = __atomic_load_n(&ref_owner_count, __ATOMIC_RELAXED);
+    uint32_t slot = 0;
+    for (uint32_t i = 1; i < count && i < OPTIHEAP_REF_MAX_OWNERS; i++) {
+        int expected = REF_OWNER_ORPHANED;
+        if (__atomic_compare_exchange_n(&ref_owners[i].state, &expected, REF_OWNER_ALIVE, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot == 0) {
+        slot = __atomic_fetch_add(&ref_owner_count, 1, __ATOMIC_RELAXED);
+        if (slot >= OPTIHEAP_REF_MAX_OWNERS) {
+            return REF_NO_OWNER;
+        }
+        __atomic_store_n(&ref_owners[slot].state, REF_OWNER_ALIVE, __ATOMIC_RELAXED);
+    }
+
+    if (pthread_setspecific(ref_owner_key, &ref_owners[slot]) != 0) {
+        ref_owner_destructor(&ref_owners[slot]); // The slot could not be given back at exit
+        return REF_NO_OWNER;
+    }
+    return slot;
+}
+
+
+/*
+ * This function returns the slot of the calling thread, merging the blocks queued on it first.
+ */
+static uint32_t ref_current_owner(void)
+{
+    uint32_t slot = ref_self;
+    if (slot == 0) {
+        slot = ref_claim_owner();
+        ref_self = slot;
+    }
+    if (slot != REF_NO_OWNER && __atomic_load_n(&ref_owners[slot].queue, __ATOMIC_RELAXED)) {
+        ref_drain(slot);
+    }
+    return slot;
+}
+
+
+/*
+ * This function checks if the calling thread counts references to block in ref_biased.
+ * Only the holder of a slot merges its blocks, so the unsynchronised check is exact for it.
+ */
+static int ref_is_biased(struct memory_header *block, uint32_t slot)
+{
+    return block->ref_owner == slot && !(__atomic_load_n(&block->ref_count, __ATOMIC_RELAXED) & REF_MERGED);
+}
+
+
+/*
+ * This function queues a block whose shared count went negative on its owner slot.
+ */
+static void ref_queue(struct memory_header *block)
+{
+    uint32_t slot = block->ref_owner;
+    struct ref_owner *owner = &ref_owners[slot];
+    struct memory_header *head = __atomic_load_n(&owner->queue, __ATOMIC_RELAXED);
+    do {
+        block->ref_next = head;
+    } while (!__atomic_compare_exchange_n(&owner->queue, &head, block, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    ref_help_orphan(slot);
+}
+#endif
+
+
+#ifdef OPTIHEAP_REFERENCE_COUNTING
+/*
+ * This function runs the destructor of a block whose last reference was released and frees it.
+ * It returns the status of the free routine.
+ */
+static void* ref_free(struct memory_header *block)
+{
+    void *ptr = (void *)(block + 1);
+    if(block->destructor) block->destructor(ptr); // Call the destructor if it exists
     if(block->magic == HEAP_ALLOCATED) {
-        mutex = &heap_mutex;
+        return free_heap_block(ptr);
+    } else if(block->magic == MMAP_ALLOCATED) {
+        return free_mmap_block(ptr);
     }
-    else {
-        mutex = &mmap_mutex;
+    return NULL;
+}
+
+
+#ifdef OPTIHEAP_BIASED_REFERENCE_COUNTING
+/*
+ * This function adds the owner's count of a queued block to its shared count and frees the block
+ * if nothing is left. The caller must hold the block's slot.
+ */
+static void ref_merge(struct memory_header *block)
+{
+    size_t delta = ((size_t)block->ref_biased << REF_SHARED_SHIFT) | REF_MERGED;
+    size_t word = __atomic_add_fetch(&block->ref_count, delta, __ATOMIC_ACQ_REL);
+    if (REF_SHARED(word) == 0) {
+        ref_free(block);
     }
-    pthread_mutex_lock(mutex);
+}
+#endif
+
+
+/*
+ * This function returns the number of references to a block.
+ * In biased mode a thread other than the owner may see a count that is slightly out of date.
+ */
+static size_t ref_total(struct memory_header *block)
+{
+    #ifdef OPTIHEAP_BIASED_REFERENCE_COUNTING
+    size_t word = __atomic_load_n(&block->ref_count, __ATOMIC_ACQUIRE);
+    intptr_t total = REF_SHARED(word);
+    if (!(word & REF_MERGED)) {
+        total += __atomic_load_n(&block->ref_biased, __ATOMIC_RELAXED);
+    }
+    return total < 0 ? 0 : (size_t)total;
+    #else
+    return __atomic_load_n(&block->ref_count, __ATOMIC_RELAXED);
     #endif
-    return mutex;
 }
+#endif
 
 
 /*
- * This function unlocks the mutex that was previously locked by optiheap_lock.
- * It takes a pointer to the mutex as an argument.
+ * This function gives a freshly allocated block one reference held by the calling thread and sets its destructor.
  */
-void optiheap_unlock([[maybe_unused]]pthread_mutex_t *mutex)
+void optiheap_reference_init([[maybe_unused]]void *ptr, [[maybe_unused]]void (*destructor)(void *))
 {
-    #ifdef OPTIHEAP_THREAD_SAFE
-    pthread_mutex_unlock(mutex);
+    #ifdef OPTIHEAP_REFERENCE_COUNTING
+    struct memory_header *block = (struct memory_header *)ptr - 1;
+    block->destructor = destructor;
+    #ifdef OPTIHEAP_BIASED_REFERENCE_COUNTING
+    uint32_t slot = ref_current_owner();
+    block->ref_next = NULL;
+    if (slot == REF_NO_OWNER) {
+        block->ref_owner = 0;
+        block->ref_biased = 0;
+        block->ref_count = REF_SHARED_ONE | REF_MERGED;
+    } else {
+        block->ref_owner = slot;
+        block->ref_biased = 1;
+        block->ref_count = 0;
+    }
+    #else
+    block->ref_count = 1;
+    #endif
     #endif
 }
 
@@ -45,10 +264,13 @@ void optiheap_unlock([[maybe_unused]]pthread_mutex_t *mutex)
 void optiheap_retain([[maybe_unused]]void *ptr)
 {
     #ifdef OPTIHEAP_REFERENCE_COUNTING
+    if (!ptr) {
+        return; // No action for null pointer
+    }
     struct memory_header *block = (struct memory_header *)ptr - 1;
 
     #ifdef OPTIHEAP_DEBUGGER
-    if(!within_heap_range(block) && !present_in_mmap_list(block)) {
+    if(!within_heap_range(block) && !is_mmap_block(block)) {
         printf("Error: Invalid pointer %p passed to optiheap_retain.\nThe address might already be freed or not allocated at all.\n", ptr);
         return;
     }
@@ -58,25 +280,32 @@ void optiheap_retain([[maybe_unused]]void *ptr)
     }
     #endif
 
-    pthread_mutex_t *mutex = optiheap_lock(block);
-
+    #ifdef OPTIHEAP_BIASED_REFERENCE_COUNTING
+    uint32_t slot = ref_current_owner();
+    if (ref_is_biased(block, slot)) {
+        #ifdef OPTIHEAP_DEBUGGER
+        if (block->ref_biased == UINT32_MAX){
+            printf("Error: Reference count overflow for pointer %p.\n", ptr);
+            return;
+        }
+        #endif
+        __atomic_store_n(&block->ref_biased, block->ref_biased + 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_add(&block->ref_count, REF_SHARED_ONE, __ATOMIC_RELAXED);
+    }
+    #else
     #ifdef OPTIHEAP_DEBUGGER
-    if (block->ref_count == SIZE_MAX){
+    if (ref_total(block) == SIZE_MAX){
         printf("Error: Reference count overflow for pointer %p.\n", ptr);
-        #ifdef OPTIHEAP_THREAD_SAFE
-        optiheap_unlock(mutex);
-        #endif
         return;
     }
     #endif
-    
-    block->ref_count++;
+    __atomic_fetch_add(&block->ref_count, 1, __ATOMIC_RELAXED);
+    #endif
 
     #ifdef OPTIHEAP_DEBUGGER
-    printf("Retained pointer %p, new reference count: %zu.\n", ptr, block->ref_count);
+    printf("Retained pointer %p, new reference count: %zu.\n", ptr, ref_total(block));
     #endif
-    
-    optiheap_unlock(mutex);
     #else
     fprintf(stderr, "Error: Reference counting is not enabled. Compile with -DOPTIHEAP_REFERENCE_COUNTING to enable it.\n");
     #endif
@@ -90,10 +319,13 @@ void optiheap_retain([[maybe_unused]]void *ptr)
 void * optiheap_release([[maybe_unused]]void *ptr)
 {
     #ifdef OPTIHEAP_REFERENCE_COUNTING
+    if (!ptr) {
+        return NULL; // No action for null pointer
+    }
     struct memory_header *block = (struct memory_header *)ptr - 1;
 
     #ifdef OPTIHEAP_DEBUGGER
-    if(!within_heap_range(block) && !present_in_mmap_list(block)) {
+    if(!within_heap_range(block) && !is_mmap_block(block)) {
         printf("Error: Invalid pointer %p passed to optiheap_release.\nThe address might already be freed or not allocated at all.\n", ptr);
         return (void *)-1; // Return -1 to indicate an error
     }
@@ -103,27 +335,58 @@ void * optiheap_release([[maybe_unused]]void *ptr)
     }
     #endif
 
-    optiheap_lock(block);
+    #ifdef OPTIHEAP_BIASED_REFERENCE_COUNTING
+    uint32_t slot = ref_current_owner();
+    size_t word;
+    int last = 0;
+    if (ref_is_biased(block, slot)) {
+        uint32_t biased = block->ref_biased - 1;
+        __atomic_store_n(&block->ref_biased, biased, __ATOMIC_RELAXED);
+        #ifdef OPTIHEAP_DEBUGGER
+        printf("Released pointer %p, new reference count: %zu.\n", ptr, ref_total(block));
+        #endif
+        if (biased == 0) {
+            // Merge unless another thread queued the block, then the queue merges it
+            word = __atomic_load_n(&block->ref_count, __ATOMIC_RELAXED);
+            do {
+                if (word & REF_QUEUED) {
+                    ref_drain(slot);
+                    return NULL;
+                }
+            } while (!__atomic_compare_exchange_n(&block->ref_count, &word, word | REF_MERGED, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+            last = REF_SHARED(word) == 0;
+        }
+    } else {
+        word = __atomic_sub_fetch(&block->ref_count, REF_SHARED_ONE, __ATOMIC_ACQ_REL);
+        #ifdef OPTIHEAP_DEBUGGER
+        printf("Released pointer %p, new reference count: %zu.\n", ptr, ref_total(block));
+        #endif
+        if (word & REF_MERGED) {
+            last = REF_SHARED(word) == 0;
+        } else if (REF_SHARED(word) < 0 && !(word & REF_QUEUED)) {
+            // Released a reference the owner counts, hand the block to the owner unless it just merged
+            size_t old = __atomic_fetch_or(&block->ref_count, REF_QUEUED, __ATOMIC_ACQ_REL);
+            if (!(old & (REF_QUEUED | REF_MERGED))) {
+                ref_queue(block);
+            }
+        }
+    }
+    if (last) {
+        return ref_free(block);
+    }
+    #else
+    size_t ref_count = __atomic_sub_fetch(&block->ref_count, 1, __ATOMIC_ACQ_REL);
 
-    block->ref_count--;
-    
     #ifdef OPTIHEAP_DEBUGGER
-    printf("Released pointer %p, new reference count: %zu.\n", ptr, block->ref_count);
+    printf("Released pointer %p, new reference count: %zu.\n", ptr, ref_count);
     #endif
 
-    if (block->ref_count == 0) {
-        if(block->destructor) block->destructor(ptr); // Call the destructor if it exists
-        if(block->magic == HEAP_ALLOCATED) {
-            return free_heap_block(ptr);
-        } else if(block->magic == MMAP_ALLOCATED) {
-            return free_mmap_block(ptr);
-        }
+    if (ref_count == 0) {
+        return ref_free(block);
     }
+    #endif
 
-    #ifdef OPTIHEAP_THREAD_SAFE
-    pthread_mutex_unlock(mutex);
     return NULL;
-    #endif
     #else
     fprintf(stderr, "Error: Reference counting is not enabled. Compile with -DOPTIHEAP_REFERENCE_COUNTING to enable it.\n");
     return (void *)-1; // Return -1 to indicate an error
@@ -138,10 +401,13 @@ void * optiheap_release([[maybe_unused]]void *ptr)
 size_t optiheap_reference_count([[maybe_unused]]void *ptr)
 {
     #ifdef OPTIHEAP_REFERENCE_COUNTING
+    if (!ptr) {
+        return 0; // No action for null pointer
+    }
     struct memory_header *block = (struct memory_header *)ptr - 1;
 
     #ifdef OPTIHEAP_DEBUGGER
-    if(!within_heap_range(block) && !present_in_mmap_list(block)) {
+    if(!within_heap_range(block) && !is_mmap_block(block)) {
         printf("Error: Invalid pointer %p passed to optiheap_reference_count.\nThe address might already be freed or not allocated at all.\n", ptr);
         return 0;
     }
@@ -151,11 +417,7 @@ size_t optiheap_reference_count([[maybe_unused]]void *ptr)
     }
     #endif
 
-    pthread_mutex_t *mutex = optiheap_lock(block);
-    size_t ref_count = block->ref_count;
-    optiheap_unlock(mutex);
-
-    return block->ref_count;
+    return ref_total(block);
     #else
     fprintf(stderr, "Error: Reference counting is not enabled. Compile with -DOPTIHEAP_REFERENCE_COUNTING to enable it.\n");
     return 0; // Return 0
@@ -188,20 +450,21 @@ int optiheap_verify_reference_counting()
     int leaks_detected = 0;
     #ifdef OPTIHEAP_REFERENCE_COUNTING
     #ifdef OPTIHEAP_DEBUGGER
-    struct memory_header *current = heap_list.head;
+    struct memory_header *current = heap_first_block();
     while (current != NULL) {
-        if (current->ref_count != 0) {
-            printf("Error: Memory leak detected for pointer %p, reference count: %zu.\n", (void *)(current + 1), current->ref_count);
+        if (current->magic == HEAP_ALLOCATED && ref_total(current) != 0) {
+            printf("Error: Memory leak detected for pointer %p, reference count: %zu.\n", (void *)(current + 1), ref_total(current));
             leaks_detected++;
         }
-        current = current->next;
+        current = heap_next_block(current);
     }
-    current = mmap_list.head;
-    while (current != NULL) {
-        if (current->ref_count != 0) {  
-            printf("Error: Memory leak detected for pointer %p, reference count: %zu.\n", (void *)(current + 1), current->ref_count);
+    struct mmap_header *mapping = mmap_list.head;
+    while (mapping != NULL) {
+        if (ref_total(&mapping->header) != 0) {  
+            printf("Error: Memory leak detected for pointer %p, reference count: %zu.\n", (void *)(&mapping->header + 1), ref_total(&mapping->header));
             leaks_detected++;
         }
+        mapping = mapping->next;
     }
     printf("Reference counting verification complete. %d leaks detected.\n", leaks_detected);
     #else
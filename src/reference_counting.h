@@ -4,6 +4,7 @@
 #include <stddef.h>
 #include "memory_structs.h"
 
+void optiheap_reference_init(void *ptr, void (*destructor)(void *));
 void optiheap_retain(void *ptr);
 void* optiheap_release(void *ptr);
 size_t optiheap_reference_count(void *ptr);
@@ -0,0 +1,181 @@
+#include "region_allocator.h"
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * This file implements regions: bump allocators for memory that is released all at once,
+ * like the scratch memory of a request. Objects carry no header and are never freed one by one,
+ * so allocating is a pointer increment and resetting a region only rewinds it to its first chunk.
+ * The chunks themselves come from optiheap_allocate, they are recycled across resets and only
+ * returned when the region is destroyed.
+ * A region is not thread safe, it is meant to be used by one thread at a time.
+ */
+
+
+/*
+ * This function creates an empty region whose ordinary chunks are chunk_size bytes,
+ * 0 selects OPTIHEAP_REGION_CHUNK_SIZE. No chunk is allocated until the first object is.
+ * It returns the region, or NULL if it could not be allocated.
+ */
+struct optiheap_region* optiheap_region_create(size_t chunk_size)
+{
+    if (chunk_size == 0) {
+        chunk_size = OPTIHEAP_REGION_CHUNK_SIZE;
+    }
+    if (chunk_size < 2 * REGION_CHUNK_HEADER_SIZE) {
+        chunk_size = 2 * REGION_CHUNK_HEADER_SIZE;
+    }
+
+    struct optiheap_region *region = optiheap_allocate(sizeof(struct optiheap_region));
+    if (region == ALLOCATION_FAILED) {
+        fprintf(stderr, "Error: Unable to allocate a region\n");
+        return NULL;
+    }
+    region->chunks = NULL;
+    region->current = NULL;
+    region->curr = NULL;
+    region->end = NULL;
+    region->chunk_size = chunk_size;
+    return region;
+}
+
+
+/*
+ * This function allocates a chunk of size bytes, header included.
+ * It returns the chunk, or NULL if no memory is available.
+ */
+static struct region_chunk* region_new_chunk(size_t size)
+{
+    struct region_chunk *chunk = optiheap_allocate(size);
+    if (chunk == ALLOCATION_FAILED) {
+        fprintf(stderr, "Error: Unable to allocate a %zu byte region chunk\n", size);
+        return NULL;
+    }
+    chunk->next = NULL;
+    chunk->end = (char *)chunk + size;
+    return chunk;
+}
+
+
+/*
+ * This function makes chunk the current chunk and bumps aligned_size bytes out of it.
+ */
+static void* region_bump_from(struct optiheap_region *region, struct region_chunk *chunk, size_t aligned_size)
+{
+    char *object = (char *)chunk + REGION_CHUNK_HEADER_SIZE;
+    region->current = chunk;
+    region->curr = object + aligned_size;
+    region->end = chunk->end;
+    return object;
+}
+
+
+/*
+ * This function serves an object that does not fit the rest of the current chunk.
+ * It moves on to the next leftover chunk if that one fits, otherwise it allocates a new chunk
+ * after the current one. An object larger than an ordinary chunk gets a chunk of its own,
+ * recycled from the leftovers when one is large enough, which is put at the head of the list
+ * so that the current chunk keeps serving the objects that follow.
+ */
+static void* region_allocate_slow(struct optiheap_region *region, size_t aligned_size)
+{
+    struct region_chunk **link = region->current ? &region->current->next : &region->chunks;
+    struct region_chunk *next = *link;
+    if (next && REGION_CHUNK_CAPACITY(next) >= aligned_size) {
+        return region_bump_from(region, next, aligned_size);
+    }
+
+    if (aligned_size > region->chunk_size - REGION_CHUNK_HEADER_SIZE) {
+        struct region_chunk *chunk = NULL;
+        for (; *link; link = &(*link)->next) {
+            if (REGION_CHUNK_CAPACITY(*link) >= aligned_size) {
+                chunk = *link;
+                *link = chunk->next;
+                break;
+            }
+        }
+        if (!chunk) {
+            if (aligned_size > SIZE_MAX - REGION_CHUNK_HEADER_SIZE) {
+                fprintf(stderr, "Error: Region object of %zu bytes is too large\n", aligned_size);
+                return ALLOCATION_FAILED;
+            }
+            chunk = region_new_chunk(REGION_CHUNK_HEADER_SIZE + aligned_size);
+            if (!chunk) {
+                return ALLOCATION_FAILED;
+            }
+        }
+        chunk->next = region->chunks;
+        region->chunks = chunk;
+        if (!region->current) {
+            region->current = chunk; // The chunk is full, the objects that follow use the next one
+            region->curr = chunk->end;
+            region->end = chunk->end;
+        }
+        return (char *)chunk + REGION_CHUNK_HEADER_SIZE;
+    }
+
+    struct region_chunk *chunk = region_new_chunk(region->chunk_size);
+    if (!chunk) {
+        return ALLOCATION_FAILED;
+    }
+    chunk->next = next;
+    *link = chunk;
+    return region_bump_from(region, chunk, aligned_size);
+}
+
+
+/*
+ * This function allocates size bytes from a region, aligned to REGION_ALIGNMENT.
+ * The object has no header and cannot be passed to optiheap_free, it lives until the
+ * region is reset or destroyed.
+ * It returns a pointer to the object, NULL for a zero size, or ALLOCATION_FAILED.
+ */
+void* optiheap_region_alloc(struct optiheap_region *region, size_t size)
+{
+    if (size == 0) {
+        return NULL; // No allocation for zero size
+    }
+    if (size > SIZE_MAX - REGION_ALIGNMENT) {
+        fprintf(stderr, "Error: Region object of %zu bytes is too large\n", size);
+        return ALLOCATION_FAILED;
+    }
+
+    size_t aligned_size = REGION_ALIGN(size);
+    if ((size_t)(region->end - region->curr) >= aligned_size) {
+        void *object = region->curr;
+        region->curr += aligned_size;
+        return object;
+    }
+    return region_allocate_slow(region, aligned_size);
+}
+
+
+/*
+ * This function releases every object of a region at once, in constant time.
+ * The chunks are kept and reused by the next objects, so a region that is reset after every
+ * request settles on the memory of its largest request and stops allocating chunks.
+ */
+void optiheap_region_reset(struct optiheap_region *region)
+{
+    region->current = NULL;
+    region->curr = NULL;
+    region->end = NULL;
+}
+
+
+/*
+ * This function frees every chunk of a region and the region itself.
+ */
+void optiheap_region_destroy(struct optiheap_region *region)
+{
+    if (!region) {
+        return;
+    }
+    struct region_chunk *chunk = region->chunks;
+    while (chunk) {
+        struct region_chunk *next = chunk->next;
+        optiheap_free(chunk);
+        chunk = next;
+    }
+    optiheap_free(region);
+}
@@ -0,0 +1,43 @@
+#ifndef REGION_ALLOCATOR_H
+#define REGION_ALLOCATOR_H
+
+#define ALLOCATION_FAILED ((void*)-1)
+
+#include <stddef.h>
+#include "../include/optiheap_allocator.h"
+
+// Default size of the chunks a region bump-allocates from
+#ifndef OPTIHEAP_REGION_CHUNK_SIZE
+#define OPTIHEAP_REGION_CHUNK_SIZE ((size_t)64 * 1024)
+#endif
+
+// Every object handed out by a region is aligned this far
+#define REGION_ALIGNMENT 16
+#define REGION_ALIGN(size) (((size) + REGION_ALIGNMENT - 1) & ~(size_t)(REGION_ALIGNMENT - 1))
+
+/*
+ * A chunk is a block taken from the heap or mmap tier, objects are bumped out of the
+ * memory after its header. Chunks stay linked to their region until it is destroyed.
+ */
+struct region_chunk {
+    struct region_chunk *next; // Next chunk of the region
+    char *end; // End of the chunk's memory
+};
+
+#define REGION_CHUNK_HEADER_SIZE REGION_ALIGN(sizeof(struct region_chunk))
+#define REGION_CHUNK_CAPACITY(chunk) ((size_t)((chunk)->end - (char *)(chunk)) - REGION_CHUNK_HEADER_SIZE)
+
+/*
+ * Chunks from the head of the list up to current hold objects, the chunks after current
+ * are left over from before the last reset and are reused in order. Chunks made for a single
+ * oversized object are put at the head, so they never sit after current while in use.
+ */
+struct optiheap_region {
+    struct region_chunk *chunks; // Head of the chunk list
+    struct region_chunk *current; // Chunk objects are bumped from, NULL right after a reset
+    char *curr; // Next free byte of the current chunk
+    char *end; // End of the current chunk
+    size_t chunk_size; // Size of the chunks allocated for ordinary objects
+};
+
+#endif // REGION_ALLOCATOR_H
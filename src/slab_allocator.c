@@ -0,0 +1,602 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS and MAP_NORESERVE are not part of strict C99
+#include "slab_allocator.h"
+#include "prefault.h"
+
+#include <sys/mman.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+/*
+ * This file implements the slab allocator used for requests of up to SLAB_MAX_SIZE bytes.
+ *
+ * Slabs are SLAB_SIZE-aligned runs of pages carved from one reserved virtual region,
+ * each holding fixed-size slots of a single size class. Free slots are linked through
+ * their own storage, so small objects carry no per-object header and are packed
+ * back to back on cache lines. All metadata lives in the slab header, which is found
+ * from any object by masking its address.
+ */
+
+struct slab_memory_list slab_list;
+
+#ifdef OPTIHEAP_THREAD_SAFE
+struct adaptive_lock slab_mutex = ADAPTIVE_LOCK_INITIALIZER;
+#endif
+
+_Static_assert(sizeof(struct slab) <= SLAB_HEADER_SIZE, "slab header must fit in SLAB_HEADER_SIZE");
+_Static_assert(SLAB_HEADER_SIZE % SLAB_SLOT_ALIGNMENT == 0, "slots must start on a cache line");
+
+static const size_t slab_class_sizes[SLAB_NUM_CLASSES] = {
+    16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512
+};
+
+// Maps ceil(size / 16) to its size class so that classification is a single load
+static const uint8_t slab_class_lookup[SLAB_MAX_SIZE / 16 + 1] = {
+    0, 0, 1, 2, 3, 4, 5, 6, 7,
+    8, 8, 9, 9, 10, 10, 11, 11,
+    12, 12, 12, 12, 13, 13, 13, 13,
+    14, 14, 14, 14, 15, 15, 15, 15
+};
+
+
+/*
+ * This function initializes the slab allocator.
+ * It resets the slab list and sets up the slot size and lock of every size class.
+ * The virtual region itself is only reserved on the first slab allocation.
+ */
+void slab_allocator_init()
+{
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_acquire(&slab_mutex);
+    #endif
+    memset(&slab_list, 0, sizeof(struct slab_memory_list));
+    for (size_t i = 0; i < SLAB_NUM_CLASSES; i++) {
+        slab_list.classes[i].slot_size = slab_class_sizes[i];
+        #ifdef OPTIHEAP_THREAD_SAFE
+        adaptive_lock_init(&slab_list.classes[i].mutex);
+        #endif
+    }
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_release(&slab_mutex);
+    #endif
+}
+
+
+/*
+ * This function returns the size class for a request of 1..SLAB_MAX_SIZE bytes.
+ */
+size_t get_slab_class(size_t size)
+{
+    return slab_class_lookup[(size + 15) >> 4];
+}
+
+
+/*
+ * This function checks if a pointer lies inside the slab region.
+ * It returns 1 if it does, otherwise returns 0.
+ * The region is reserved once and never moves, so no lock is needed.
+ */
+int within_slab_range(void *ptr)
+{
+    return ptr >= (void *)slab_list.region_base && ptr < (void *)slab_list.region_curr;
+}
+
+
+static struct slab* slab_of(void *ptr)
+{
+    return (struct slab *)((uintptr_t)ptr & ~((uintptr_t)SLAB_SIZE - 1));
+}
+
+
+/*
+ * This function returns the size class recorded in the slab of ptr.
+ * It is clamped so that a corrupted header can never index past the class table,
+ * validate_slab_block rejects such pointers afterwards.
+ */
+static size_t slab_class_of(void *ptr)
+{
+    return slab_of(ptr)->size_class % SLAB_NUM_CLASSES;
+}
+
+
+/*
+ * This function reserves the slab region, aligned to SLAB_SIZE.
+ * The range is mapped PROT_NONE so it costs no memory until slabs are committed.
+ * The caller must hold slab_mutex.
+ */
+static int reserve_slab_region(void)
+{
+    size_t reserve_size = OPTIHEAP_SLAB_REGION_SIZE + SLAB_SIZE;
+    char *region = mmap(NULL, reserve_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (region == MAP_FAILED) {
+        fprintf(stderr, "Error: mmap failed to reserve %zu bytes for slabs\n", reserve_size);
+        return -1;
+    }
+
+    // Trim the unaligned head and the leftover tail of the reservation
+    char *aligned = (char *)(((uintptr_t)region + SLAB_SIZE - 1) & ~((uintptr_t)SLAB_SIZE - 1));
+    if (aligned > region) {
+        munmap(region, aligned - region);
+    }
+    char *aligned_end = aligned + OPTIHEAP_SLAB_REGION_SIZE;
+    if (aligned_end < region + reserve_size) {
+        munmap(aligned_end, region + reserve_size - aligned_end);
+    }
+
+    slab_list.region_base = slab_list.region_curr = aligned;
+    slab_list.region_end = aligned_end;
+    return 0;
+}
+
+
+/*
+ * This function hands out an empty slab for the given size class.
+ * Slabs released to the shared pool are reused first, otherwise a new slab is committed from the region.
+ * It returns NULL when the region is exhausted.
+ */
+static struct slab* new_slab(size_t size_class)
+{
+    struct slab *slab = NULL;
+
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_acquire(&slab_mutex);
+    #endif
+
+    if (slab_list.empty_slabs) {
+        slab = slab_list.empty_slabs;
+        slab_list.empty_slabs = slab->next;
+    } else if (slab_list.region_base || reserve_slab_region() == 0) {
+        if (slab_list.region_curr + SLAB_SIZE <= slab_list.region_end &&
+            mprotect(slab_list.region_curr, SLAB_SIZE, PROT_READ | PROT_WRITE) == 0) {
+            slab = (struct slab *)slab_list.region_curr;
+            slab_list.region_curr += SLAB_SIZE;
+        }
+    }
+
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_release(&slab_mutex);
+    #endif
+
+    if (!slab) {
+        return NULL;
+    }
+
+    size_t slot_size = slab_list.classes[size_class].slot_size;
+    memset(slab, 0, sizeof(struct slab));
+    slab->magic = SLAB_MAGIC;
+    slab->size_class = (uint16_t)size_class;
+    slab->slot_size = (uint16_t)slot_size;
+    slab->capacity = (uint32_t)((SLAB_SIZE - SLAB_HEADER_SIZE) / slot_size);
+    slab->slot_reciprocal = (uint32_t)(((uint64_t)1 << 32) / slot_size + 1);
+    slab->bump = (char *)slab + SLAB_HEADER_SIZE;
+    slab->end = slab->bump + (size_t)slab->capacity * slot_size;
+    return slab;
+}
+
+
+/*
+ * This function returns an empty slab to the shared pool so any class can reuse it.
+ * Its pages are handed back to the kernel, a reused slab therefore starts out zeroed.
+ */
+static void release_slab(struct slab *slab)
+{
+    madvise((char *)slab + SLAB_HEADER_SIZE, SLAB_SIZE - SLAB_HEADER_SIZE, MADV_DONTNEED);
+
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_acquire(&slab_mutex);
+    #endif
+    slab->magic = 0;
+    slab->next = slab_list.empty_slabs;
+    slab_list.empty_slabs = slab;
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_release(&slab_mutex);
+    #endif
+}
+
+
+static void insert_into_partial_list(struct slab_class *class, struct slab *slab)
+{
+    slab->prev = NULL;
+    slab->next = class->partial;
+    if (class->partial) {
+        class->partial->prev = slab;
+    }
+    class->partial = slab;
+}
+
+
+static void remove_from_partial_list(struct slab_class *class, struct slab *slab)
+{
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        class->partial = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = slab->prev = NULL;
+}
+
+
+/*
+ * This function returns the index of the slot at or before ptr.
+ * Offsets stay below SLAB_SIZE, where the reciprocal multiplication gives the exact quotient.
+ */
+static size_t slab_slot_index(struct slab *slab, void *ptr)
+{
+    uint64_t offset = (uint64_t)((char *)ptr - ((char *)slab + SLAB_HEADER_SIZE));
+    return (size_t)((offset * slab->slot_reciprocal) >> 32);
+}
+
+
+/*
+ * This function checks that ptr is the start of a handed-out slot of slab and stores its index.
+ * It returns 1 if it is, otherwise returns 0.
+ */
+static int slab_slot_of(struct slab *slab, void *ptr, size_t *index)
+{
+    char *slots = (char *)slab + SLAB_HEADER_SIZE;
+    if (slab->magic != SLAB_MAGIC || (char *)ptr < slots || (char *)ptr >= slab->bump) {
+        return 0;
+    }
+    *index = slab_slot_index(slab, ptr);
+    return slots + *index * slab->slot_size == (char *)ptr;
+}
+
+
+static void set_allocated_bit(struct slab *slab, size_t index)
+{
+    uint64_t bit = (uint64_t)1 << (index % 64);
+    #ifdef OPTIHEAP_THREAD_SAFE
+    if (!adaptive_lock_elided()) {
+        __atomic_fetch_or(&slab->allocated[index / 64], bit, __ATOMIC_RELAXED);
+        return;
+    }
+    #endif
+    slab->allocated[index / 64] |= bit;
+}
+
+
+/*
+ * This function clears the allocated bit of a slot.
+ * It returns 1 if the slot was allocated, or 0 if it was already free.
+ */
+static int clear_allocated_bit(struct slab *slab, size_t index)
+{
+    uint64_t bit = (uint64_t)1 << (index % 64);
+    #ifdef OPTIHEAP_THREAD_SAFE
+    if (!adaptive_lock_elided()) {
+        return (__atomic_fetch_and(&slab->allocated[index / 64], ~bit, __ATOMIC_RELAXED) & bit) != 0;
+    }
+    #endif
+    uint64_t old = slab->allocated[index / 64];
+    slab->allocated[index / 64] = old & ~bit;
+    return (old & bit) != 0;
+}
+
+
+/*
+ * This function takes one slot from the class, pulling in a new slab if every slab is full.
+ * Recycled slots are preferred over never-used ones to keep the working set small.
+ * The caller must hold the class mutex.
+ */
+static void* allocate_slab_block_unlocked(size_t size_class)
+{
+    struct slab_class *class = &slab_list.classes[size_class];
+    struct slab *slab = class->partial;
+
+    if (!slab) {
+        slab = new_slab(size_class);
+        if (!slab) {
+            return ALLOCATION_FAILED;
+        }
+        insert_into_partial_list(class, slab);
+        class->empty_count++;
+    }
+
+    void *slot;
+    if (slab->free_list) {
+        slot = slab->free_list;
+        slab->free_list = *(void **)slot;
+    } else {
+        slot = slab->bump;
+        slab->bump += slab->slot_size;
+    }
+
+    set_allocated_bit(slab, slab_slot_index(slab, slot));
+    if (slab->used++ == 0) {
+        class->empty_count--;
+    }
+    if (slab->used == slab->capacity) {
+        remove_from_partial_list(class, slab); // Full slabs are only reachable through their objects
+    }
+    return slot;
+}
+
+
+/*
+ * This function checks, without reporting, that ptr is the start of a handed-out slot.
+ * It returns 1 if it is, otherwise returns 0.
+ */
+int is_slab_block(void *ptr)
+{
+    size_t index;
+    return slab_slot_of(slab_of(ptr), ptr, &index);
+}
+
+
+/*
+ * This function sets the allocated bit of a slot that passed is_slab_block.
+ */
+void slab_mark_allocated(void *ptr)
+{
+    struct slab *slab = slab_of(ptr);
+    set_allocated_bit(slab, slab_slot_index(slab, ptr));
+}
+
+
+/*
+ * This function clears the allocated bit of the slot starting at ptr, without reporting.
+ * It returns 1 if ptr was an allocated slot, or 0 if it is not a slot or was already free.
+ */
+int slab_mark_free(void *ptr)
+{
+    struct slab *slab = slab_of(ptr);
+    size_t index;
+    return slab_slot_of(slab, ptr, &index) && clear_allocated_bit(slab, index);
+}
+
+
+/*
+ * This function validates that ptr is the start of a live slot and marks the slot free.
+ * It returns the owning slab, or NULL if the pointer is not a valid slab object
+ * or the slot was already freed.
+ */
+static struct slab* validate_slab_block(void *ptr)
+{
+    struct slab *slab = slab_of(ptr);
+    if (slab->magic != SLAB_MAGIC) {
+        fprintf(stderr, "Error: Attempt to free pointer %p from an unused slab\n", ptr);
+        return NULL;
+    }
+    size_t index;
+    if (!slab_slot_of(slab, ptr, &index)) {
+        fprintf(stderr, "Error: Attempt to free invalid or corrupted pointer %p\n", ptr);
+        return NULL;
+    }
+    if (!clear_allocated_bit(slab, index)) {
+        fprintf(stderr, "Error: Attempt to free pointer %p that has already been freed\n", ptr);
+        return NULL;
+    }
+    return slab;
+}
+
+
+/*
+ * This function puts a slot back on its slab's free list.
+ * A slab that was full becomes partial again, and surplus empty slabs go back to the shared pool.
+ * The caller must hold the mutex of the slab's class.
+ */
+static void free_slab_block_unlocked(struct slab *slab, void *ptr)
+{
+    struct slab_class *class = &slab_list.classes[slab->size_class];
+
+    if (slab->used == slab->capacity) {
+        insert_into_partial_list(class, slab);
+    }
+
+    *(void **)ptr = slab->free_list;
+    slab->free_list = ptr;
+
+    if (--slab->used == 0) {
+        if (class->empty_count >= SLAB_MAX_EMPTY_PER_CLASS) {
+            remove_from_partial_list(class, slab);
+            release_slab(slab);
+        } else {
+            class->empty_count++;
+        }
+    }
+}
+
+
+/*
+ * This function allocates a slot for a request of 1..SLAB_MAX_SIZE bytes.
+ * It returns a pointer to the slot, or ALLOCATION_FAILED if no slab could be obtained,
+ * in which case the caller falls back to the heap allocator.
+ */
+void* allocate_slab_block(size_t size)
+{
+    if (size == 0) {
+        return NULL;
+    }
+    if (size > SLAB_MAX_SIZE) {
+        return ALLOCATION_FAILED;
+    }
+
+    size_t size_class = get_slab_class(size);
+
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_acquire(&slab_list.classes[size_class].mutex);
+    #endif
+
+    void *slot = allocate_slab_block_unlocked(size_class);
+
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_release(&slab_list.classes[size_class].mutex);
+    #endif
+
+    return slot;
+}
+
+
+/*
+ * This function allocates up to count slots of one size class while taking the class mutex only once.
+ * It returns the number of slots written to out.
+ */
+size_t allocate_slab_blocks(size_t size_class, void **out, size_t count)
+{
+    size_t allocated = 0;
+
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_acquire(&slab_list.classes[size_class].mutex);
+    #endif
+
+    while (allocated < count) {
+        void *slot = allocate_slab_block_unlocked(size_class);
+        if (slot == ALLOCATION_FAILED) {
+            break;
+        }
+        out[allocated++] = slot;
+    }
+
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_release(&slab_list.classes[size_class].mutex);
+    #endif
+
+    return allocated;
+}
+
+
+/*
+ * This function makes sure at least count slots of one size class can be handed out without
+ * pulling in a new slab. The missing slabs are added to the class as empty slabs, beyond
+ * SLAB_MAX_EMPTY_PER_CLASS, and faulted in, so their first objects take no page fault either.
+ * It returns 0 on success, or -1 if the slab region is exhausted.
+ */
+int slab_reserve(size_t size_class, size_t count)
+{
+    int result = 0;
+    struct slab_class *class = &slab_list.classes[size_class];
+
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_acquire(&class->mutex);
+    #endif
+
+    size_t available = 0;
+    for (struct slab *slab = class->partial; slab && available < count; slab = slab->next) {
+        available += slab->capacity - slab->used;
+    }
+    while (available < count) {
+        struct slab *slab = new_slab(size_class);
+        if (!slab) {
+            result = -1;
+            break;
+        }
+        prefault_pages(slab->bump, (size_t)(slab->end - slab->bump));
+        insert_into_partial_list(class, slab);
+        class->empty_count++;
+        available += slab->capacity;
+    }
+
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_release(&class->mutex);
+    #endif
+
+    return result;
+}
+
+
+/*
+ * This function frees a slot previously returned by allocate_slab_block.
+ * returns NULL if deallocation is successful
+ * returns DEALLOCATION_FAILED if the pointer is not a live slab object
+ */
+void* free_slab_block(void *ptr)
+{
+    if (!ptr) {
+        return NULL;
+    }
+
+    struct slab *slab = slab_of(ptr);
+    void *status = NULL;
+
+    #ifdef OPTIHEAP_THREAD_SAFE
+    // The class of a slab can only change once it is empty and released,
+    // which cannot happen while the caller still owns one of its slots.
+    struct adaptive_lock *mutex = &slab_list.classes[slab_class_of(ptr)].mutex;
+    adaptive_lock_acquire(mutex);
+    #endif
+
+    if (validate_slab_block(ptr)) {
+        free_slab_block_unlocked(slab, ptr);
+    } else {
+        status = DEALLOCATION_FAILED;
+    }
+
+    #ifdef OPTIHEAP_THREAD_SAFE
+    adaptive_lock_release(mutex);
+    #endif
+    return status;
+}
+
+
+/*
+ * This function frees count slots, taking each class mutex once per run of same-class slots.
+ * Every slot goes through the allocated bitmap, so a pointer listed twice is only freed once.
+ * It returns the number of pointers that failed validation or were already free.
+ */
+size_t free_slab_blocks(void **ptrs, size_t count)
+{
+    size_t failed = 0;
+    size_t i = 0;
+
+    while (i < count) {
+        size_t size_class = slab_class_of(ptrs[i]);
+
+        #ifdef OPTIHEAP_THREAD_SAFE
+        adaptive_lock_acquire(&slab_list.classes[size_class].mutex);
+        #endif
+
+        for (; i < count && slab_class_of(ptrs[i]) == size_class; i++) {
+            struct slab *slab = validate_slab_block(ptrs[i]);
+            if (slab) {
+                free_slab_block_unlocked(slab, ptrs[i]);
+            } else {
+                failed++;
+            }
+        }
+
+        #ifdef OPTIHEAP_THREAD_SAFE
+        adaptive_lock_release(&slab_list.classes[size_class].mutex);
+        #endif
+    }
+
+    return failed;
+}
+
+
+/*
+ * This function returns the usable size of a slab object, i.e. its slot size.
+ */
+size_t slab_block_size(void *ptr)
+{
+    return slab_of(ptr)->slot_size;
+}
+
+
+void debug_print_slab([[maybe_unused]]int debug_id)
+{
+    #ifdef OPTIHEAP_DEBUGGER
+    printf("================================================================= START DEBUG_ID : %d\n", debug_id);
+    printf("Slab Memory State:\n");
+    printf("Slab Region: %p - %p, committed up to %p\n",
+        (void *)slab_list.region_base, (void *)slab_list.region_end, (void *)slab_list.region_curr);
+    for (size_t i = 0; i < SLAB_NUM_CLASSES; i++) {
+        struct slab_class *class = &slab_list.classes[i];
+        #ifdef OPTIHEAP_THREAD_SAFE
+        adaptive_lock_acquire(&class->mutex);
+        #endif
+        for (struct slab *slab = class->partial; slab; slab = slab->next) {
+            printf("Slab at %p: \t slot_size=%u, used=%u/%u\n",
+                (void *)slab, slab->slot_size, slab->used, slab->capacity);
+        }
+        #ifdef OPTIHEAP_THREAD_SAFE
+        adaptive_lock_release(&class->mutex);
+        #endif
+    }
+    printf("================================================================= END DEBUG_ID : %d\n", debug_id);
+    #else
+    printf("Warning: OptiHeap Debugger is disabled. Enable it by compiling with -DOPTIHEAP_DEBUGGER flag to see slab state.\n");
+    #endif
+}
@@ -0,0 +1,91 @@
+#ifndef SLAB_ALLOCATOR_H
+#define SLAB_ALLOCATOR_H
+
+#define ALLOCATION_FAILED ((void*)-1)
+#define DEALLOCATION_FAILED ((void*)-2)
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef OPTIHEAP_THREAD_SAFE
+#include "adaptive_lock.h"
+#endif
+
+#define SLAB_MAGIC 0x51AB51AB
+
+#define SLAB_SIZE (64 * 1024) // Every slab is SLAB_SIZE bytes and aligned to SLAB_SIZE
+#define SLAB_HEADER_SIZE 576 // Header and allocated bitmap, a whole number of cache lines
+#define SLAB_SLOT_ALIGNMENT 64 // Slots start on a cache line
+#define SLAB_MAX_SLOTS ((SLAB_SIZE - SLAB_HEADER_SIZE) / 16) // Slots of the smallest class
+#define SLAB_BITMAP_WORDS ((SLAB_MAX_SLOTS + 63) / 64)
+#define SLAB_MAX_SIZE 512 // Largest request served by the slab allocator
+#define SLAB_NUM_CLASSES 16 // Slot sizes: 16..128 step 16, 160..256 step 32, 320..512 step 64
+#define SLAB_MAX_EMPTY_PER_CLASS 2 // Empty slabs kept per class before they go back to the shared pool
+
+#ifndef OPTIHEAP_SLAB_REGION_SIZE
+#define OPTIHEAP_SLAB_REGION_SIZE (16ULL * 1024 * 1024 * 1024) // Virtual range reserved for slabs
+#endif
+
+/*
+ * Slab metadata lives at the start of every slab, objects carry no header at all.
+ * The owning slab of an object is found by masking its address with SLAB_SIZE.
+ * The allocated bitmap has one bit per slot, set while the slot is in the caller's hands,
+ * so a second free of the same slot is caught in every build. Slots parked in a thread cache
+ * have their bit clear. Once the process has a second thread, thread-safe builds update the
+ * bitmap with atomic operations, as thread caches change it without the class mutex.
+ */
+struct slab {
+    struct slab *next; // Next slab in the class's partial list or in the empty pool
+    struct slab *prev; // Prev slab in the class's partial list
+    void *free_list; // Freed slots, linked through their first word
+    char *bump; // First slot that was never handed out
+    char *end; // End of the slot area
+    uint32_t magic; // SLAB_MAGIC for validation
+    uint16_t size_class; // Index into slab_list.classes
+    uint16_t slot_size; // Size of every slot in bytes
+    uint32_t used; // Number of live slots
+    uint32_t capacity; // Number of slots in the slab
+    uint32_t slot_reciprocal; // 2^32 / slot_size + 1, turns the slot index division into a multiplication
+    uint64_t allocated[SLAB_BITMAP_WORDS]; // One bit per slot, set while the slot is allocated
+};
+
+struct slab_class {
+    struct slab *partial; // Slabs with at least one free slot
+    size_t empty_count; // Number of completely empty slabs in the partial list
+    size_t slot_size;
+    #ifdef OPTIHEAP_THREAD_SAFE
+    struct adaptive_lock mutex; // Guards this class's slabs only
+    #endif
+};
+
+struct slab_memory_list {
+    struct slab_class classes[SLAB_NUM_CLASSES];
+    struct slab *empty_slabs; // Pool of released slabs shared by all classes
+
+    // Reserved virtual region that slabs are carved from
+    char *region_base;
+    char *region_curr;
+    char *region_end;
+};
+
+extern struct slab_memory_list slab_list;
+
+#ifdef OPTIHEAP_THREAD_SAFE
+extern struct adaptive_lock slab_mutex; // Guards the region and the empty slab pool
+#endif
+
+void slab_allocator_init(void);
+size_t get_slab_class(size_t size);
+void* allocate_slab_block(size_t size);
+void* free_slab_block(void *ptr);
+size_t allocate_slab_blocks(size_t size_class, void **out, size_t count);
+size_t free_slab_blocks(void **ptrs, size_t count);
+int slab_reserve(size_t size_class, size_t count);
+size_t slab_block_size(void *ptr);
+int is_slab_block(void *ptr);
+void slab_mark_allocated(void *ptr);
+int slab_mark_free(void *ptr);
+int within_slab_range(void *ptr);
+void debug_print_slab(int debug_id);
+
+#endif // SLAB_ALLOCATOR_H
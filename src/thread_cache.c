@@ -0,0 +1,335 @@
+#include "memory_structs.h"
+#include "heap_allocator.h"
+#include "slab_allocator.h"
+#include "thread_cache.h"
+
+/*
+ * This file implements per-thread caches that sit in front of allocate_heap_block
+ * and free_heap_block when OptiHeap is built with OPTIHEAP_THREAD_SAFE.
+ *
+ * Every thread owns one bin per slab size class and one bin per heap block size.
+ * A bin is a singly linked stack of blocks threaded through the first word of their
+ * payloads, so the common allocate/free pair only pushes and pops a pointer and never
+ * takes a heap arena lock or a slab class mutex. Empty bins are refilled and full bins are
+ * drained in batches, which amortises one lock round-trip over many operations.
+ *
+ * Cached heap blocks stay carved out of the heap and are tagged HEAP_CACHED, so they are
+ * never coalesced while parked and a double free into the cache is still detected.
+ * Cached slab slots remain allocated in their slab with their allocated bit cleared,
+ * which catches a double free into the cache the same way.
+ */
+
+#ifdef OPTIHEAP_THREAD_SAFE
+
+#include <pthread.h>
+#include <stdio.h>
+
+#define THREAD_CACHE_UNINITIALIZED 0
+#define THREAD_CACHE_ACTIVE 1
+#define THREAD_CACHE_DISABLED 2 // thread is exiting, bypass the cache
+
+struct thread_cache_bin {
+    void *head; // Top of the stack of cached payloads
+    size_t count; // Number of blocks in the bin
+};
+
+struct thread_cache {
+    int state;
+    struct thread_cache_bin slab_bins[SLAB_NUM_CLASSES];
+    struct thread_cache_bin bins[OPTIHEAP_THREAD_CACHE_BINS];
+};
+
+static __thread struct thread_cache thread_cache;
+
+static size_t thread_cache_depth = OPTIHEAP_THREAD_CACHE_DEFAULT_DEPTH;
+
+static pthread_key_t thread_cache_key;
+static pthread_once_t thread_cache_key_once = PTHREAD_ONCE_INIT;
+
+
+/*
+ * This function is the pthread key destructor, it runs when a thread that used
+ * the cache exits and hands every cached block back to the shared heap.
+ */
+static void thread_cache_destructor([[maybe_unused]]void *arg)
+{
+    thread_cache_flush();
+    thread_cache.state = THREAD_CACHE_DISABLED;
+}
+
+
+static void thread_cache_create_key(void)
+{
+    pthread_key_create(&thread_cache_key, thread_cache_destructor);
+}
+
+
+/*
+ * This function registers the calling thread's cache so that it is flushed on thread exit.
+ * It returns 1 if the cache can be used, otherwise returns 0.
+ */
+static int thread_cache_ready(void)
+{
+    if (thread_cache.state == THREAD_CACHE_ACTIVE) {
+        return 1;
+    }
+    if (thread_cache.state == THREAD_CACHE_DISABLED) {
+        return 0;
+    }
+    pthread_once(&thread_cache_key_once, thread_cache_create_key);
+    if (pthread_setspecific(thread_cache_key, &thread_cache) != 0) {
+        return 0;
+    }
+    thread_cache.state = THREAD_CACHE_ACTIVE;
+    return 1;
+}
+
+
+/*
+ * This function returns the bin index for a block of aligned_size bytes,
+ * or OPTIHEAP_THREAD_CACHE_BINS if blocks of that size are not cached.
+ */
+static size_t thread_cache_bin_index(size_t aligned_size)
+{
+    size_t index = aligned_size / HEAP_ALIGNMENT - 1;
+    return index < OPTIHEAP_THREAD_CACHE_BINS ? index : OPTIHEAP_THREAD_CACHE_BINS;
+}
+
+
+static void thread_cache_push(struct thread_cache_bin *bin, void *ptr)
+{
+    *(void **)ptr = bin->head;
+    bin->head = ptr;
+    bin->count++;
+}
+
+
+static void* thread_cache_pop(struct thread_cache_bin *bin)
+{
+    void *ptr = bin->head;
+    bin->head = *(void **)ptr;
+    bin->count--;
+    return ptr;
+}
+
+
+/*
+ * Cached slab slots have their allocated bit clear, like cached heap blocks are tagged HEAP_CACHED,
+ * so that freeing one of them a second time is still detected.
+ */
+static void thread_cache_push_slab(struct thread_cache_bin *bin, void *ptr)
+{
+    slab_mark_free(ptr);
+    thread_cache_push(bin, ptr);
+}
+
+
+static void* thread_cache_pop_slab(struct thread_cache_bin *bin)
+{
+    void *ptr = thread_cache_pop(bin);
+    slab_mark_allocated(ptr);
+    return ptr;
+}
+
+
+static void thread_cache_push_heap(struct thread_cache_bin *bin, void *ptr)
+{
+    ((struct memory_header *)ptr - 1)->magic = HEAP_CACHED;
+    thread_cache_push(bin, ptr);
+}
+
+
+static void* thread_cache_pop_heap(struct thread_cache_bin *bin)
+{
+    void *ptr = thread_cache_pop(bin);
+    ((struct memory_header *)ptr - 1)->magic = HEAP_ALLOCATED;
+    return ptr;
+}
+
+
+/*
+ * This function moves up to count blocks from a heap bin back to the shared heap
+ * with one lock round-trip per arena involved.
+ */
+static void thread_cache_drain(struct thread_cache_bin *bin, size_t count)
+{
+    void *batch[OPTIHEAP_THREAD_CACHE_MAX_DEPTH];
+    size_t drained = 0;
+    while (bin->head && drained < count) {
+        batch[drained++] = thread_cache_pop_heap(bin);
+    }
+    if (drained) {
+        free_heap_blocks(batch, drained);
+    }
+}
+
+
+/*
+ * This function moves up to count slots from a slab bin back to their slabs
+ * using a single round-trip on the class mutex.
+ */
+static void thread_cache_drain_slab(struct thread_cache_bin *bin, size_t count)
+{
+    void *batch[OPTIHEAP_THREAD_CACHE_MAX_DEPTH];
+    size_t drained = 0;
+    while (bin->head && drained < count) {
+        batch[drained++] = thread_cache_pop_slab(bin);
+    }
+    if (drained) {
+        free_slab_blocks(batch, drained);
+    }
+}
+
+
+/*
+ * This function serves a slab-sized allocation from the calling thread's slab bin,
+ * refilling an empty bin with half the configured depth in one batch.
+ */
+static void* thread_cache_allocate_slab(size_t size)
+{
+    size_t size_class = get_slab_class(size);
+    struct thread_cache_bin *bin = &thread_cache.slab_bins[size_class];
+    if (!bin->head) {
+        size_t refill = thread_cache_depth / 2;
+        if (refill == 0) {
+            return NULL; // Caching is disabled
+        }
+        void *batch[OPTIHEAP_THREAD_CACHE_MAX_DEPTH];
+        size_t filled = allocate_slab_blocks(size_class, batch, refill);
+        for (size_t i = 0; i < filled; i++) {
+            thread_cache_push_slab(bin, batch[i]);
+        }
+        if (!bin->head) {
+            return NULL;
+        }
+    }
+    return thread_cache_pop_slab(bin);
+}
+
+
+/*
+ * This function serves an allocation of size bytes from the calling thread's cache.
+ * An empty bin is refilled with half the configured depth in one batch.
+ * It returns NULL if the size is not cached or the backing allocator could not supply blocks,
+ * in which case the caller falls back to allocate_slab_block / allocate_heap_block.
+ */
+void* thread_cache_allocate(size_t size)
+{
+    if (size <= SLAB_MAX_SIZE) {
+        return thread_cache_ready() ? thread_cache_allocate_slab(size) : NULL;
+    }
+
+    size_t aligned_size = HEAP_ALIGN(size);
+    size_t index = thread_cache_bin_index(aligned_size);
+    if (index == OPTIHEAP_THREAD_CACHE_BINS || !thread_cache_ready()) {
+        return NULL;
+    }
+
+    struct thread_cache_bin *bin = &thread_cache.bins[index];
+    if (!bin->head) {
+        size_t refill = thread_cache_depth / 2;
+        if (refill == 0) {
+            return NULL; // Caching is disabled
+        }
+        void *batch[OPTIHEAP_THREAD_CACHE_MAX_DEPTH];
+        size_t filled = allocate_heap_blocks(aligned_size, batch, refill);
+        for (size_t i = 0; i < filled; i++) {
+            thread_cache_push_heap(bin, batch[i]);
+        }
+        if (!bin->head) {
+            return NULL;
+        }
+    }
+    return thread_cache_pop_heap(bin);
+}
+
+
+/*
+ * This function parks a heap block in the calling thread's cache instead of freeing it.
+ * A full bin is first drained by half so that the next frees stay lock-free.
+ * The block must belong to the calling thread's arena (see heap_block_is_local): blocks of
+ * another arena go back to their owner's remote-free queue rather than drifting into this one.
+ * It returns 1 if the block was cached, otherwise returns 0 and the caller must free it.
+ */
+int thread_cache_free(void *ptr)
+{
+    struct memory_header *block = (struct memory_header *)ptr - 1;
+    if (block->magic != HEAP_ALLOCATED) {
+        return 0; // Let free_heap_block report the invalid pointer
+    }
+
+    size_t index = thread_cache_bin_index(BLOCK_SIZE(block));
+    size_t depth = thread_cache_depth;
+    if (index == OPTIHEAP_THREAD_CACHE_BINS || depth == 0 || !thread_cache_ready()) {
+        return 0;
+    }
+
+    struct thread_cache_bin *bin = &thread_cache.bins[index];
+    if (bin->count >= depth) {
+        thread_cache_drain(bin, bin->count - depth / 2);
+    }
+    thread_cache_push_heap(bin, ptr);
+    return 1;
+}
+
+
+/*
+ * This function parks a slab object in the calling thread's slab bin instead of freeing it.
+ * It returns 1 if the object was cached, otherwise returns 0 and the caller must free it.
+ */
+int thread_cache_free_slab(void *ptr)
+{
+    size_t depth = thread_cache_depth;
+    if (depth == 0 || !thread_cache_ready() || !slab_mark_free(ptr)) {
+        return 0; // Invalid pointers and double frees are reported by free_slab_block
+    }
+
+    struct thread_cache_bin *bin = &thread_cache.slab_bins[get_slab_class(slab_block_size(ptr))];
+    if (bin->count >= depth) {
+        thread_cache_drain_slab(bin, bin->count - depth / 2);
+    }
+    thread_cache_push(bin, ptr); // The allocated bit is already clear
+    return 1;
+}
+
+
+/*
+ * This function returns every block cached by the calling thread to the shared heap.
+ */
+void thread_cache_flush(void)
+{
+    for (size_t i = 0; i < SLAB_NUM_CLASSES; i++) {
+        while (thread_cache.slab_bins[i].head) {
+            thread_cache_drain_slab(&thread_cache.slab_bins[i], OPTIHEAP_THREAD_CACHE_MAX_DEPTH);
+        }
+    }
+    for (size_t i = 0; i < OPTIHEAP_THREAD_CACHE_BINS; i++) {
+        while (thread_cache.bins[i].head) {
+            thread_cache_drain(&thread_cache.bins[i], OPTIHEAP_THREAD_CACHE_MAX_DEPTH);
+        }
+    }
+}
+
+
+/*
+ * This function sets the maximum number of blocks each bin may hold, 0 disables caching.
+ * Bins that are already deeper shrink lazily on their next free.
+ * It returns 0 on success, or -1 if the depth exceeds OPTIHEAP_THREAD_CACHE_MAX_DEPTH.
+ */
+int thread_cache_set_depth(size_t depth)
+{
+    if (depth > OPTIHEAP_THREAD_CACHE_MAX_DEPTH) {
+        fprintf(stderr, "Error: Thread cache depth %zu exceeds the maximum of %d\n", depth, OPTIHEAP_THREAD_CACHE_MAX_DEPTH);
+        return -1;
+    }
+    thread_cache_depth = depth;
+    return 0;
+}
+
+
+size_t thread_cache_get_depth(void)
+{
+    return thread_cache_depth;
+}
+
+#endif // OPTIHEAP_THREAD_SAFE
@@ -0,0 +1,29 @@
+#ifndef THREAD_CACHE_H
+#define THREAD_CACHE_H
+
+#include <stddef.h>
+#include "memory_structs.h"
+
+// Number of per-thread heap bins, bin_i caches heap blocks of (i+1) * HEAP_ALIGNMENT bytes
+#ifndef OPTIHEAP_THREAD_CACHE_BINS
+#define OPTIHEAP_THREAD_CACHE_BINS 256
+#endif
+
+// Hard upper bound on the number of blocks a single bin may hold
+#ifndef OPTIHEAP_THREAD_CACHE_MAX_DEPTH
+#define OPTIHEAP_THREAD_CACHE_MAX_DEPTH 256
+#endif
+
+// Depth used until it is tuned through optiheap_set_option()
+#ifndef OPTIHEAP_THREAD_CACHE_DEFAULT_DEPTH
+#define OPTIHEAP_THREAD_CACHE_DEFAULT_DEPTH 32
+#endif
+
+void* thread_cache_allocate(size_t size);
+int thread_cache_free(void *ptr);
+int thread_cache_free_slab(void *ptr);
+void thread_cache_flush(void);
+int thread_cache_set_depth(size_t depth);
+size_t thread_cache_get_depth(void);
+
+#endif // THREAD_CACHE_H
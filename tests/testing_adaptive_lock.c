@@ -0,0 +1,95 @@
+#define _DEFAULT_SOURCE // fork and waitpid are not part of strict C99
+#include "../include/optiheap_allocator.h"
+#include "../src/mmap_allocator.h"
+#include "../src/slab_allocator.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+
+#ifdef OPTIHEAP_THREAD_SAFE
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../src/adaptive_lock.h"
+
+#define LIVE_COUNT 64
+
+static size_t sizes[] = {48, 2000, 20000, 300 * 1024};
+static unsigned char *live[LIVE_COUNT];
+
+// Allocates and frees blocks of every tier, checking that each one keeps its contents
+static void churn(int rounds)
+{
+    for (int round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            unsigned char *p = optiheap_allocate(sizes[i]);
+            assert(p != NULL && p != (void *)-1);
+            memset(p, round, sizes[i]);
+            assert(p[sizes[i] - 1] == (unsigned char)round);
+            assert(optiheap_free(p) == NULL);
+        }
+    }
+}
+
+// Frees the blocks the main thread allocated before any thread existed
+static void *free_live_blocks(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < LIVE_COUNT; i++) {
+        assert(live[i][0] == (unsigned char)i);
+        assert(optiheap_free(live[i]) == NULL);
+    }
+    churn(200);
+    return NULL;
+}
+#endif
+
+int main()
+{
+    #ifdef OPTIHEAP_THREAD_SAFE
+    optiheap_allocator_init();
+
+    // 1. Before the first pthread_create locks are skipped and left free
+    churn(10);
+    for (int i = 0; i < LIVE_COUNT; i++) {
+        live[i] = optiheap_allocate(sizes[i % 4]);
+        memset(live[i], i, sizes[i % 4]);
+    }
+    #ifndef OPTIHEAP_NO_LOCK_ELISION
+    assert(adaptive_lock_elided() || !ADAPTIVE_LOCK_SINGLE_THREADED());
+    #endif
+    assert(mmap_mutex.state == ADAPTIVE_LOCK_FREE && slab_mutex.state == ADAPTIVE_LOCK_FREE);
+
+    // 2. A fork of the single-threaded process runs the atfork handlers over elided locks on both sides
+    pid_t child = fork();
+    assert(child != -1);
+    if (child == 0) {
+        churn(10);
+        for (int i = 0; i < LIVE_COUNT; i++) {
+            if (live[i][0] != (unsigned char)i || optiheap_free(live[i]) != NULL) {
+                _exit(1);
+            }
+        }
+        _exit(0);
+    }
+    int status;
+    assert(waitpid(child, &status, 0) == child);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    churn(10);
+    assert(mmap_mutex.state == ADAPTIVE_LOCK_FREE && slab_mutex.state == ADAPTIVE_LOCK_FREE);
+
+    // 3. Once a thread exists locks are taken, and blocks from the single-threaded phase free normally
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, free_live_blocks, NULL) == 0);
+    churn(200);
+    assert(pthread_join(thread, NULL) == 0);
+    assert(!adaptive_lock_elided());
+    assert(mmap_mutex.state == ADAPTIVE_LOCK_FREE && slab_mutex.state == ADAPTIVE_LOCK_FREE);
+    churn(10);
+
+    printf("All adaptive lock tests passed!\n");
+    #else
+    printf("Adaptive locks need -DOPTIHEAP_THREAD_SAFE, nothing to test.\n");
+    #endif
+    return 0;
+}
@@ -1,5 +1,54 @@
 #include "../src/heap_allocator.h"
 #include <stdio.h>
+#include <assert.h>
+#include <string.h>
+
+// Returns the index of the size group whose segment holds ptr
+static size_t group_of(void *ptr)
+{
+    for (struct heap_segment *segment = heap_segments; segment; segment = segment->next) {
+        if ((char *)ptr > (char *)segment && (char *)ptr < segment->end) {
+            return (size_t)(segment->group - segment->group->arena->groups);
+        }
+    }
+    assert(!"pointer outside every segment");
+    return 0;
+}
+
+// Allocates and grows blocks across the 1 KiB, 8 KiB and 64 KiB group boundaries, then frees them
+static void test_size_groups(void)
+{
+    size_t sizes[] = {1000, 8000, 60000};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        size_t size = sizes[i];
+        size_t grown_size = size * 2; // Past the group's upper bound
+        assert(heap_size_group(HEAP_ALIGN(grown_size)) != heap_size_group(HEAP_ALIGN(size)) || HEAP_SIZE_GROUPS == 1);
+
+        unsigned char *larger = allocate_heap_block(grown_size);
+        unsigned char *block = allocate_heap_block(size);
+        assert(group_of(block) == heap_size_group(HEAP_ALIGN(size)));
+        assert(group_of(larger) == heap_size_group(HEAP_ALIGN(grown_size)));
+        assert(HEAP_SIZE_GROUPS == 1 || group_of(block) != group_of(larger)); // Never in the same segment
+
+        // The block borders its segment's tail, so it grows in place and stays in its group
+        memset(block, 0x5A, size);
+        assert(reallocate_heap_block(block, grown_size) == block);
+        assert(group_of(block) == heap_size_group(HEAP_ALIGN(size)));
+        memset(block, 0x5B, grown_size);
+        unsigned char *after = allocate_heap_block(size);
+        assert(after == block + grown_size + sizeof(struct memory_header));
+
+        // The grown block is freed into its own group's lists, and is split for the next block of its group
+        assert(free_heap_block(block) == NULL);
+        unsigned char *reused = allocate_heap_block(size);
+        assert(reused == block);
+        assert(free_heap_block(reused) == NULL);
+        assert(free_heap_block(after) == NULL);
+        assert(free_heap_block(larger) == NULL);
+        assert(free_heap_block(block) != NULL);
+        assert(heap_first_block() == NULL); // Everything coalesced back into the segment tails
+    }
+}
 
 int main()
 {
@@ -87,5 +136,11 @@ int main()
     debug_print_heap(debug_id++);
     // passed
 
+    // 10
+    assert(heap_first_block() == NULL);
+    test_size_groups();
+    debug_print_heap(debug_id++);
+    // passed
+
     return 0;
 }
\ No newline at end of file
@@ -1,7 +1,65 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS is not part of strict C99
 #include "../include/optiheap_allocator.h"
 #include <stdio.h>
 #include <assert.h>
 #include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef OPTIHEAP_THREAD_SAFE
+#include <pthread.h>
+#include "../src/thread_cache.h"
+
+// Adds up the stats of every arena into total
+static void sum_arena_stats(struct optiheap_arena_stats *total) {
+    struct optiheap_arena_stats stats;
+    memset(total, 0, sizeof(*total));
+    for (size_t i = 0; optiheap_get_arena_stats(i, &stats) == 0; i++) {
+        total->used_bytes += stats.used_bytes;
+        total->threads += stats.threads;
+        total->remote_frees += stats.remote_frees;
+    }
+}
+
+#define HANDOFF_COUNT 1000
+#define HANDOFF_SIZE 2000
+
+static void *handoff[HANDOFF_COUNT];
+static int handoff_ready, handoff_freed;
+
+// Allocates the blocks another thread frees, and stays alive until they are freed if wait is set
+static void *produce_handoff(void *wait) {
+    for (int i = 0; i < HANDOFF_COUNT; i++) {
+        handoff[i] = optiheap_allocate(HANDOFF_SIZE);
+        memset(handoff[i], i, HANDOFF_SIZE);
+    }
+    __atomic_store_n(&handoff_ready, 1, __ATOMIC_RELEASE);
+    while (wait && !__atomic_load_n(&handoff_freed, __ATOMIC_ACQUIRE)) {
+    }
+    return NULL;
+}
+
+// Allocates and frees heap and slab sizes, then reports the arena bytes still in use before the thread exits
+static void *churn_thread_cache(void *used_bytes) {
+    size_t churn_sizes[] = {24, 200, 512, 1000, 2000, 4096};
+    void *blocks[64];
+    for (int round = 0; round < 10; round++) {
+        for (size_t i = 0; i < sizeof(churn_sizes) / sizeof(churn_sizes[0]); i++) {
+            for (int j = 0; j < 64; j++) {
+                blocks[j] = optiheap_allocate(churn_sizes[i]);
+                memset(blocks[j], j, churn_sizes[i]);
+            }
+            for (int j = 0; j < 64; j++) {
+                assert(optiheap_free(blocks[j]) == NULL);
+            }
+        }
+    }
+    struct optiheap_arena_stats total;
+    sum_arena_stats(&total);
+    *(size_t *)used_bytes = total.used_bytes;
+    return NULL;
+}
+#endif
 
 int main() {
 
@@ -42,6 +100,339 @@ int main() {
     // 7. Free NULL (should do nothing)
     assert(optiheap_free(NULL) == NULL);
 
+    // 8. Zeroed allocations are cleared even when they recycle a dirty block
+    size_t sizes[] = {24, 2000, 64 * 1024, 1024 * 256};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        unsigned char *dirty = optiheap_allocate(sizes[i]);
+        memset(dirty, 0xAB, sizes[i]);
+        assert(optiheap_free(dirty) == NULL);
+        unsigned char *zeroed = optiheap_calloc(sizes[i], 1);
+        assert(zeroed != NULL && zeroed != (void *)-1);
+        for (size_t j = 0; j < sizes[i]; j++) {
+            assert(zeroed[j] == 0);
+        }
+        assert(optiheap_free(zeroed) == NULL);
+    }
+
+    // 9. nmemb * size overflow is rejected
+    assert(optiheap_calloc(SIZE_MAX / 2, 4) == (void *)-1);
+
+    // 10. Aligned allocations on every tier are aligned, usable and freed like any other block
+    size_t alignments[] = {32, 64, 256, 4096, 1024 * 1024};
+    size_t aligned_sizes[] = {40, 1000, 100000, 1024 * 512};
+    for (size_t i = 0; i < sizeof(alignments) / sizeof(alignments[0]); i++) {
+        for (size_t j = 0; j < sizeof(aligned_sizes) / sizeof(aligned_sizes[0]); j++) {
+            unsigned char *p = optiheap_aligned_allocate(alignments[i], aligned_sizes[j]);
+            assert(p != NULL && p != (void *)-1);
+            assert(((uintptr_t)p & (alignments[i] - 1)) == 0);
+            memset(p, 0x5A, aligned_sizes[j]);
+            assert(optiheap_free(p) == NULL);
+        }
+    }
+
+    // 11. Invalid alignments are rejected
+    void *aligned = NULL;
+    assert(optiheap_aligned_allocate(48, 100) == (void *)-1);
+    assert(optiheap_posix_memalign(&aligned, 4, 100) != 0);
+    assert(optiheap_posix_memalign(&aligned, 128, 100) == 0 && ((uintptr_t)aligned & 127) == 0);
+    assert(optiheap_free(aligned) == NULL);
+
+    // 12. A short-lived mmap block raises the threshold, so the heap serves blocks of its size
+    size_t threshold = optiheap_get_option(OPTIHEAP_OPTION_MMAP_THRESHOLD);
+    void *large = optiheap_allocate(4 * 1024 * 1024);
+    assert(optiheap_free(large) == NULL);
+    assert(optiheap_get_option(OPTIHEAP_OPTION_MMAP_THRESHOLD) > threshold);
+    assert(optiheap_get_option(OPTIHEAP_OPTION_MMAP_THRESHOLD) <= optiheap_get_option(OPTIHEAP_OPTION_MMAP_THRESHOLD_MAX));
+
+    // 13. Freed mappings are reused from the mmap cache, disabling the cache releases them
+    assert(optiheap_set_option(OPTIHEAP_OPTION_MMAP_THRESHOLD, 128 * 1024) == 0);
+    large = optiheap_allocate(1024 * 1024);
+    assert(optiheap_free(large) == NULL);
+    assert(optiheap_get_option(OPTIHEAP_OPTION_MMAP_THRESHOLD) == 128 * 1024); // Pinned
+    void *reused = optiheap_allocate(1024 * 1024 - 100);
+    assert(reused == large);
+    assert(optiheap_free(reused) == NULL);
+    assert(optiheap_set_option(OPTIHEAP_OPTION_MMAP_CACHE_LIMIT, 0) == 0);
+    assert(optiheap_get_option(OPTIHEAP_OPTION_MMAP_CACHE_LIMIT) == 0);
+    assert(optiheap_free(reused) != NULL); // Double free is still detected
+
+    // 14. Trimming returns free heap memory without touching live blocks
+    assert(optiheap_set_option(OPTIHEAP_OPTION_MMAP_THRESHOLD, 8 * 1024 * 1024) == 0);
+    unsigned char *spike = optiheap_allocate(4 * 1024 * 1024);
+    unsigned char *live = optiheap_allocate(64 * 1024);
+    memset(spike, 0x11, 4 * 1024 * 1024);
+    memset(live, 0x22, 64 * 1024);
+    assert(optiheap_free(spike) == NULL);
+    assert(optiheap_trim(0) == 1);
+    for (size_t i = 0; i < 64 * 1024; i++) {
+        assert(live[i] == 0x22);
+    }
+    spike = optiheap_allocate(4 * 1024 * 1024); // Released pages are usable again
+    memset(spike, 0x33, 4 * 1024 * 1024);
+    assert(optiheap_free(spike) == NULL);
+    assert(optiheap_free(live) == NULL);
+
+    // 15. The arena serving this thread accounts for its blocks
+    struct optiheap_arena_stats stats_before, stats_after;
+    assert(optiheap_get_arena_stats(0, &stats_before) == 0);
+    void *medium = optiheap_allocate(100 * 1024);
+    assert(optiheap_get_arena_stats(0, &stats_after) == 0);
+    assert(stats_after.segments >= 1);
+    assert(stats_after.used_bytes >= stats_before.used_bytes + 100 * 1024);
+    assert(optiheap_free(medium) == NULL);
+    assert(optiheap_get_arena_stats(SIZE_MAX, &stats_after) == -1);
+
+    // 16. Batches hand out distinct usable blocks of every tier and free them in one call
+    assert(optiheap_set_option(OPTIHEAP_OPTION_MMAP_THRESHOLD, 128 * 1024) == 0);
+    size_t batch_sizes[] = {48, 1000, 200000};
+    void *batch[64];
+    for (size_t i = 0; i < sizeof(batch_sizes) / sizeof(batch_sizes[0]); i++) {
+        assert(optiheap_allocate_batch(batch_sizes[i], 64, batch) == 64);
+        for (size_t j = 0; j < 64; j++) {
+            assert(optiheap_usable_size(batch[j]) >= batch_sizes[i]);
+            memset(batch[j], (int)j, batch_sizes[i]);
+        }
+        for (size_t j = 0; j < 64; j++) {
+            assert(((unsigned char *)batch[j])[batch_sizes[i] - 1] == (unsigned char)j);
+        }
+        assert(optiheap_free(batch[63]) == NULL);
+        batch[63] = batch[0]; // The same pointer twice is caught, in every build
+        assert(optiheap_free_batch(batch, 64) == 1);
+        void *first = optiheap_allocate(batch_sizes[i]);
+        void *second = optiheap_allocate(batch_sizes[i]);
+        assert(first != second); // and the duplicate left no trace in the free lists
+        assert(optiheap_free(first) == NULL);
+        assert(optiheap_free(second) == NULL);
+    }
+
+    // 17. Sized frees release blocks of every tier, any size up to the usable size is accepted
+    size_t sized[] = {24, 3000, 600 * 1024};
+    for (size_t i = 0; i < sizeof(sized) / sizeof(sized[0]); i++) {
+        void *p = optiheap_allocate(sized[i]);
+        assert(optiheap_free_sized(p, sized[i]) == NULL);
+        p = optiheap_allocate(sized[i]);
+        assert(optiheap_free_sized(p, optiheap_usable_size(p)) == NULL);
+    }
+    assert(optiheap_free_sized(NULL, 100) == NULL);
+
+    // 18. Region objects are aligned and disjoint, a reset hands the same memory out again
+    struct optiheap_region *region = optiheap_region_create(4096);
+    assert(region != NULL);
+    assert(optiheap_region_alloc(region, 0) == NULL);
+    unsigned char *objects[100];
+    unsigned char *first = NULL;
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < 100; i++) {
+            objects[i] = optiheap_region_alloc(region, 100 + i);
+            assert(objects[i] != (void *)-1 && ((uintptr_t)objects[i] & 15) == 0);
+            memset(objects[i], i, 100 + i);
+        }
+        for (int i = 0; i < 100; i++) {
+            assert(objects[i][0] == i && objects[i][99 + i] == i);
+        }
+        assert(round == 0 || objects[0] == first);
+        first = objects[0];
+        optiheap_region_reset(region);
+    }
+    unsigned char *oversized = optiheap_region_alloc(region, 64 * 1024);
+    assert(oversized != (void *)-1);
+    memset(oversized, 0xEE, 64 * 1024);
+    assert(optiheap_region_alloc(region, 16) == first); // Small objects continue in the ordinary chunks
+    assert(oversized[64 * 1024 - 1] == 0xEE);
+    optiheap_region_destroy(region);
+
+    // 19. Pool objects are packed at their size, recycled last in first out, and foreign pointers are rejected
+    assert(optiheap_pool_create(24, 3) == NULL);
+    struct optiheap_pool *pool = optiheap_pool_create(24, 0);
+    assert(pool != NULL);
+    unsigned char *pooled[3000];
+    for (int i = 0; i < 3000; i++) {
+        pooled[i] = optiheap_pool_alloc(pool);
+        assert(pooled[i] != (void *)-1 && ((uintptr_t)pooled[i] & 7) == 0);
+        memset(pooled[i], i, 24);
+    }
+    assert(pooled[1] - pooled[0] == 24);
+    for (int i = 0; i < 3000; i++) {
+        assert(pooled[i][0] == (unsigned char)i && pooled[i][23] == (unsigned char)i);
+    }
+    assert(optiheap_pool_free(pool, pooled[7]) == NULL);
+    assert(optiheap_pool_alloc(pool) == pooled[7]);
+    assert(optiheap_pool_free(pool, pooled[0] + 1) != NULL);
+    assert(optiheap_pool_free(pool, pooled[9]) == NULL && optiheap_pool_free(pool, pooled[9]) != NULL); // Double free
+    assert(optiheap_pool_free(pool, pooled[2900]) == NULL && optiheap_pool_free(pool, pooled[2900]) != NULL);
+    unsigned char *pool_reused[3] = {optiheap_pool_alloc(pool), optiheap_pool_alloc(pool), optiheap_pool_alloc(pool)};
+    assert(pool_reused[0] == pooled[2900] && pool_reused[1] == pooled[9] && pool_reused[2] != pool_reused[0] && pool_reused[2] != pool_reused[1]);
+    optiheap_pool_destroy(pool);
+    pool = optiheap_pool_create(100 * 1024, 0); // One object per chunk
+    pooled[0] = optiheap_pool_alloc(pool);
+    pooled[1] = optiheap_pool_alloc(pool);
+    assert(pooled[0] != (void *)-1 && pooled[1] != (void *)-1 && pooled[0] != pooled[1]);
+    assert(optiheap_pool_free(pool, pooled[0]) == NULL && optiheap_pool_free(pool, pooled[0]) != NULL);
+    assert(optiheap_pool_alloc(pool) == pooled[0] && optiheap_pool_alloc(pool) != pooled[0]);
+    optiheap_pool_destroy(pool);
+    pool = optiheap_pool_create(100, 256);
+    assert(((uintptr_t)optiheap_pool_alloc(pool) & 255) == 0 && ((uintptr_t)optiheap_pool_alloc(pool) & 255) == 0);
+    optiheap_pool_destroy(pool);
+
+    // 20. In huge page mode large blocks are 2 MiB aligned mappings, accounted until they are freed
+    struct optiheap_huge_page_stats huge_stats;
+    assert(optiheap_set_option(OPTIHEAP_OPTION_HUGE_PAGES, OPTIHEAP_HUGE_PAGES_EXPLICIT + 1) == -1);
+    assert(optiheap_set_option(OPTIHEAP_OPTION_HUGE_PAGES, OPTIHEAP_HUGE_PAGES_TRANSPARENT) == 0);
+    unsigned char *huge = optiheap_allocate(6 * 1024 * 1024);
+    memset(huge, 0x77, 6 * 1024 * 1024);
+    assert(((uintptr_t)huge & (2 * 1024 * 1024 - 1)) < 4096); // The header opens an aligned mapping
+    assert(optiheap_get_huge_page_stats(&huge_stats) == 0);
+    assert(huge_stats.mmap_advised_bytes + huge_stats.mmap_hugetlb_bytes >= 6 * 1024 * 1024);
+    huge = optiheap_reallocate(huge, 9 * 1024 * 1024);
+    assert(huge[6 * 1024 * 1024 - 1] == 0x77);
+    assert(optiheap_free(huge) == NULL);
+    assert(optiheap_get_huge_page_stats(&huge_stats) == 0);
+    assert(huge_stats.mmap_advised_bytes == 0 && huge_stats.mmap_hugetlb_bytes == 0);
+    assert(optiheap_set_option(OPTIHEAP_OPTION_HUGE_PAGES, OPTIHEAP_HUGE_PAGES_OFF) == 0);
+
+    // 21. Warm-up and reservations commit heap memory up front, populated blocks keep their contents
+    struct optiheap_warmup_class warmup[] = {{64, 5000}, {4000, 1000}, {64 * 1024 * 1024, 1}};
+    assert(optiheap_get_arena_stats(0, &stats_before) == 0);
+    assert(optiheap_warmup(warmup, 3) == 0);
+    assert(optiheap_reserve(8 * 1024 * 1024, 4000) == 0);
+    assert(optiheap_reserve(64 * 1024, 64) == 0);
+    assert(optiheap_get_arena_stats(0, &stats_after) == 0);
+    assert(stats_after.committed_bytes >= stats_before.committed_bytes + 4000 * 1000);
+    unsigned char *populated = optiheap_allocate_flags(3 * 1024 * 1024, OPTIHEAP_ALLOCATE_POPULATE | OPTIHEAP_ALLOCATE_ZERO);
+    assert(populated != (void *)-1 && populated[0] == 0 && populated[3 * 1024 * 1024 - 1] == 0);
+    assert(optiheap_free(populated) == NULL);
+    populated = optiheap_allocate_flags(100, OPTIHEAP_ALLOCATE_POPULATE);
+    assert(populated != (void *)-1);
+    memset(populated, 0x55, 100);
+    assert(optiheap_free(populated) == NULL);
+
+    // 22. Lock contention counters are only kept by thread-safe builds with OPTIHEAP_LOCK_STATS
+    struct optiheap_lock_stats lock_stats;
+    #if defined(OPTIHEAP_THREAD_SAFE) && defined(OPTIHEAP_LOCK_STATS)
+    assert(optiheap_get_lock_stats(&lock_stats) == 0);
+    assert(lock_stats.spin_acquisitions <= lock_stats.contended_acquisitions);
+    #else
+    assert(optiheap_get_lock_stats(&lock_stats) == -1);
+    #endif
+    assert(optiheap_get_lock_stats(NULL) == -1);
+
+    // 23. A second free of a block whose pages were decommitted is rejected instead of faulting
+    void *trimmed[32];
+    for (size_t i = 0; i < 32; i++) {
+        trimmed[i] = optiheap_allocate(60 * 1024);
+    }
+    for (size_t i = 0; i < 32; i++) {
+        assert(optiheap_free(trimmed[i]) == NULL);
+    }
+    optiheap_trim(0);
+    assert(optiheap_free(trimmed[31]) != NULL);
+
+    // 24. Reallocation resizes in place where it can and keeps the contents whenever a block moves
+    assert(optiheap_set_option(OPTIHEAP_OPTION_MMAP_THRESHOLD, 128 * 1024) == 0);
+    unsigned char *resized = optiheap_allocate(4000);
+    memset(resized, 0x61, 4000);
+    assert(optiheap_reallocate(resized, 1000) == resized); // Split shrink
+    assert(resized[999] == 0x61);
+    void *neighbours[3];
+    assert(optiheap_allocate_batch(10000, 3, neighbours) == 3); // Carved back to back
+    memset(neighbours[0], 0x62, 10000);
+    assert(optiheap_free(neighbours[1]) == NULL);
+    assert(optiheap_reallocate(neighbours[0], 15000) == neighbours[0]); // Absorbs the freed neighbour
+    assert(((unsigned char *)neighbours[0])[9999] == 0x62);
+    assert(optiheap_usable_size(neighbours[0]) >= 15000);
+    assert(optiheap_free(neighbours[2]) == NULL);
+    assert(optiheap_free(neighbours[0]) == NULL);
+    unsigned char *tail = optiheap_allocate(80 * 1024); // Nothing live follows it, so it borders the segment tail
+    memset(tail, 0x63, 80 * 1024);
+    assert(optiheap_reallocate(tail, 120 * 1024) == tail); // Grows into the segment tail
+    assert(tail[80 * 1024 - 1] == 0x63);
+    unsigned char *mapped = optiheap_reallocate(tail, 1024 * 1024); // Heap to mmap
+    assert(mapped != (void *)-1 && mapped[80 * 1024 - 1] == 0x63);
+    memset(mapped, 0x64, 1024 * 1024);
+    mapped = optiheap_reallocate(mapped, 3 * 1024 * 1024); // mremap
+    assert(mapped != (void *)-1 && mapped[1024 * 1024 - 1] == 0x64);
+    assert(optiheap_usable_size(mapped) >= 3 * 1024 * 1024);
+    assert(optiheap_reallocate(mapped, 512 * 1024) == mapped); // Shrinking a mapping keeps its address
+    assert(optiheap_reallocate(mapped, SIZE_MAX - 10) == (void *)-1); // Would wrap around to a tiny mapping
+    assert(optiheap_usable_size(mapped) >= 512 * 1024 && mapped[512 * 1024 - 1] == 0x64);
+    unsigned char *heap_again = optiheap_reallocate(mapped, 2000); // mmap to heap
+    assert(heap_again != (void *)-1 && heap_again[1999] == 0x64);
+    assert(optiheap_reallocate(heap_again, 0) == NULL); // Frees the block
+    assert(optiheap_free(heap_again) != NULL);
+    unsigned char *small = optiheap_allocate(100);
+    memset(small, 0x65, 100);
+    unsigned char *grown = optiheap_reallocate(small, 3000); // Slab to heap
+    assert(grown != (void *)-1 && grown != small && grown[99] == 0x65);
+    assert(optiheap_free(grown) == NULL);
+    assert(optiheap_reallocate(&dummy, 100) == (void *)-1);
+    assert(optiheap_reallocate(&dummy, 1024 * 1024) == (void *)-1);
+    assert(optiheap_reallocate(resized + 16, 100) == (void *)-1);
+    assert(optiheap_reallocate(mapped, 100) == (void *)-1); // Unmapped, the mmap cache is disabled
+    assert(optiheap_free(resized) == NULL);
+
+    // 25. Blocks freed by another arena's thread are returned when their arena's threads exit, or directly once they have
+    #ifdef OPTIHEAP_THREAD_SAFE
+    struct optiheap_arena_stats baseline, total;
+    assert(optiheap_set_option(OPTIHEAP_OPTION_ARENA_COUNT, 4) == 0); // The producer never shares this thread's arena
+    sum_arena_stats(&baseline);
+    for (int wait = 1; wait >= 0; wait--) {
+        pthread_t producer;
+        handoff_ready = handoff_freed = 0;
+        pthread_create(&producer, NULL, produce_handoff, wait ? &wait : NULL);
+        if (!wait) {
+            pthread_join(producer, NULL);
+        }
+        while (!__atomic_load_n(&handoff_ready, __ATOMIC_ACQUIRE)) {
+        }
+        for (int i = 0; i < HANDOFF_COUNT; i++) {
+            assert(((unsigned char *)handoff[i])[HANDOFF_SIZE - 1] == (unsigned char)i);
+            assert(optiheap_free(handoff[i]) == NULL);
+        }
+        sum_arena_stats(&total);
+        if (wait) {
+            assert(total.used_bytes >= baseline.used_bytes + HANDOFF_COUNT * HANDOFF_SIZE); // Queued for the producer
+            __atomic_store_n(&handoff_freed, 1, __ATOMIC_RELEASE);
+            pthread_join(producer, NULL);
+            sum_arena_stats(&total);
+        }
+        assert(total.used_bytes == baseline.used_bytes);
+        assert(total.threads == baseline.threads);
+        assert(total.remote_frees == baseline.remote_frees + HANDOFF_COUNT);
+        assert(optiheap_free(handoff[0]) != NULL); // Double free is still detected
+        baseline = total;
+    }
+    #endif
+
+    // 26. A thread's cache holds freed blocks until the thread exits, a depth of 0 disables it
+    #ifdef OPTIHEAP_THREAD_SAFE
+    size_t depth = optiheap_get_option(OPTIHEAP_OPTION_THREAD_CACHE_DEPTH);
+    assert(optiheap_set_option(OPTIHEAP_OPTION_THREAD_CACHE_DEPTH, OPTIHEAP_THREAD_CACHE_MAX_DEPTH + 1) == -1);
+    assert(optiheap_get_option(OPTIHEAP_OPTION_THREAD_CACHE_DEPTH) == depth);
+    sum_arena_stats(&baseline);
+    for (int disabled = 0; disabled <= 1; disabled++) {
+        size_t used_at_exit;
+        pthread_t worker;
+        assert(optiheap_set_option(OPTIHEAP_OPTION_THREAD_CACHE_DEPTH, disabled ? 0 : depth) == 0);
+        pthread_create(&worker, NULL, churn_thread_cache, &used_at_exit);
+        pthread_join(worker, NULL);
+        assert(disabled ? used_at_exit == baseline.used_bytes : used_at_exit > baseline.used_bytes);
+        sum_arena_stats(&total);
+        assert(total.used_bytes == baseline.used_bytes); // Flushed when the worker exited
+    }
+    assert(optiheap_set_option(OPTIHEAP_OPTION_THREAD_CACHE_DEPTH, depth) == 0);
+    #endif
+
+    // 27. A foreign pointer whose header would lie on an unmapped page is rejected without reading it
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    char *pages = mmap(NULL, 2 * page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(pages != MAP_FAILED && munmap(pages, page_size) == 0);
+    void *foreign = pages + page_size;
+    assert(optiheap_usable_size(foreign) == 0);
+    assert(optiheap_reallocate(foreign, 100) == (void *)-1);
+    assert(optiheap_free_sized(foreign, 100) != NULL); // Debug builds check the size against the usable size first
+    assert(optiheap_free_sized(foreign, 1024 * 1024) != NULL);
+    munmap(foreign, page_size);
+
     printf("All edge/robustness tests passed!\n");
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,88 @@
+#!/bin/bash
+
+# LD_PRELOAD smoke test
+# Builds the preload library and runs ordinary programs with it in place of the libc allocator.
+# Run from anywhere: bash tests/testing_preload.sh
+
+set -e  # Exit on any error
+
+cd "$(dirname "$0")/.."
+make preload > /dev/null
+PRELOAD="$(pwd)/lib/liboptiheap_preload.so"
+
+run() {
+    echo "Running: $*" >&2
+    LD_PRELOAD="$PRELOAD" "$@"
+}
+
+# 1. The library is actually loaded into the programs it is preloaded into
+run grep -q liboptiheap_preload.so /proc/self/maps
+
+# 2. Pattern matching, grep's matcher setup calls realloc(NULL, 0) and must get a block back
+[ "$(printf 'hello\nworld\n' | run grep hello)" = "hello" ]
+[ "$(printf 'hello\nworld\n' | run grep 'w[a-z]*l\+d')" = "world" ]
+
+# 3. Directory listings and sorting, which allocate, grow and free many small and large buffers
+run ls -la / > /dev/null
+[ "$(seq 200000 | run sort -rn | head -1)" = "200000" ]
+[ "$(seq 100000 | run sort -R | run sort -n | tail -1)" = "100000" ]
+
+# 4. A shell pipeline, which forks and execs with the library loaded
+[ "$(run sh -c 'for i in 1 2 3 4 5; do echo $i; done | wc -l')" = "5" ]
+
+# 5. A threaded workload that starts subprocesses, if Python is available
+if command -v python3 > /dev/null; then
+    run python3 -c '
+import subprocess, threading
+results = []
+def work(n):
+    data = [bytes(i % 256 for i in range(j % 5000)) for j in range(2000)]
+    out = subprocess.run(["echo", str(n)], capture_output=True, text=True).stdout.strip()
+    results.append((out == str(n)) and len(data) == 2000)
+threads = [threading.Thread(target=work, args=(n,)) for n in range(8)]
+for t in threads: t.start()
+for t in threads: t.join()
+assert len(results) == 8 and all(results)
+'
+else
+    echo "python3 not found, skipping the threaded workload"
+fi
+
+# 6. Requests too large to map fail with ENOMEM instead of wrapping around to a small block
+WORK_DIR="$(mktemp -d)"
+trap 'rm -rf "$WORK_DIR"' EXIT
+cat > "$WORK_DIR/huge.c" << 'END_OF_SOURCE'
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(void)
+{
+    for (size_t k = 1; k <= 4096 * 1024; k *= 4) {
+        errno = 0;
+        assert(malloc(SIZE_MAX - k) == NULL && errno == ENOMEM);
+        assert(calloc(1, SIZE_MAX - k) == NULL);
+        assert(aligned_alloc(64, SIZE_MAX - k) == NULL);
+        assert(aligned_alloc(4096, SIZE_MAX - k) == NULL);
+        void *aligned = NULL;
+        assert(posix_memalign(&aligned, 4096, SIZE_MAX - k) == ENOMEM && aligned == NULL);
+
+        size_t sizes[] = {100, 3000, 1024 * 1024};
+        for (size_t i = 0; i < 3; i++) {
+            char *p = malloc(sizes[i]);
+            memset(p, 0x5A, sizes[i]);
+            errno = 0;
+            assert(realloc(p, SIZE_MAX - k) == NULL && errno == ENOMEM);
+            assert(p[sizes[i] - 1] == 0x5A); // Left untouched
+            free(p);
+        }
+    }
+    return 0;
+}
+END_OF_SOURCE
+${CC:-gcc} -O0 -fno-builtin -o "$WORK_DIR/huge" "$WORK_DIR/huge.c"
+run "$WORK_DIR/huge" 2> /dev/null
+
+echo "All preload tests passed!"
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <assert.h>
+#include <pthread.h>
 #include "../include/optiheap_allocator.h"
 
 static int destructor_called = 0;
@@ -86,6 +87,29 @@ void test_interleaved_allocations() {
     assert(destructor_called == 2);
 }
 
+static void *release_from_thread(void *ptr) {
+    optiheap_retain(ptr);
+    optiheap_release(ptr);
+    optiheap_release(ptr); // Drops the reference taken by the allocating thread
+    return NULL;
+}
+
+void test_cross_thread_release() {
+    destructor_called = 0;
+    void *ptr = optiheap_reference_allocate(64, test_destructor);
+    assert(ptr != NULL);
+    optiheap_retain(ptr);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, release_from_thread, ptr);
+    pthread_join(thread, NULL);
+    assert(destructor_called == 0);
+    assert(optiheap_reference_count(ptr) == 1);
+
+    optiheap_release(ptr); // Last reference, whichever thread counted the others
+    assert(destructor_called == 1);
+}
+
 void test_leak_detection() {
     destructor_called = 0;
     void *ptr = optiheap_reference_allocate(64, test_destructor);
@@ -117,6 +141,9 @@ int main() {
     test_interleaved_allocations();
     printf("test_interleaved_allocations passed.\n");
 
+    test_cross_thread_release();
+    printf("test_cross_thread_release passed.\n");
+
     test_leak_detection();
     printf("test_leak_detection passed.\n");
 
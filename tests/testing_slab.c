@@ -0,0 +1,63 @@
+#include "../src/slab_allocator.h"
+#include <stdio.h>
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+int main()
+{
+    slab_allocator_init();
+
+    int debug_id = 0;
+
+    // 1. Every size up to SLAB_MAX_SIZE maps to a slot that is large enough
+    for (size_t size = 1; size <= SLAB_MAX_SIZE; size++) {
+        void *p = allocate_slab_block(size);
+        assert(p != NULL && p != ALLOCATION_FAILED);
+        assert(slab_block_size(p) >= size);
+        assert(((uintptr_t)p & 15) == 0);
+        assert(free_slab_block(p) == NULL);
+    }
+
+    // 2. Objects of one class are packed back to back without headers
+    void *a = allocate_slab_block(64);
+    void *b = allocate_slab_block(64);
+    assert((char *)b - (char *)a == 64 || (char *)a - (char *)b == 64);
+
+    // 3. Freed slots are reused first
+    assert(free_slab_block(a) == NULL);
+    void *c = allocate_slab_block(60);
+    assert(c == a);
+
+    debug_print_slab(debug_id++);
+
+    // 4. Filling more than one slab keeps every object intact
+    static void *objects[5000];
+    for (size_t i = 0; i < 5000; i++) {
+        objects[i] = allocate_slab_block(32);
+        assert(objects[i] != ALLOCATION_FAILED);
+        memset(objects[i], (int)(i & 0xFF), 32);
+    }
+    for (size_t i = 0; i < 5000; i++) {
+        assert(((unsigned char *)objects[i])[31] == (unsigned char)(i & 0xFF));
+        assert(free_slab_block(objects[i]) == NULL);
+    }
+
+    // 5. Pointers into the middle of a slot are rejected
+    assert(free_slab_block((char *)b + 8) == DEALLOCATION_FAILED);
+    assert(free_slab_block(b) == NULL);
+    assert(free_slab_block(c) == NULL);
+
+    // 6. A slot freed twice is rejected and not handed out twice
+    assert(free_slab_block(b) == DEALLOCATION_FAILED);
+    void *d = allocate_slab_block(64);
+    void *e = allocate_slab_block(64);
+    assert(d != e);
+    assert(free_slab_block(d) == NULL);
+    assert(free_slab_block(e) == NULL);
+
+    debug_print_slab(debug_id++);
+
+    printf("All slab allocator tests passed!\n");
+    return 0;
+}